@@ -0,0 +1,155 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+/* An arena hands out memory from big chunks, which are only freed
+   all together. Every directory has one for its entries, the strings
+   of them and the entries of its subdirectories, see dir_arena. So
+   the scan of a directory with thousands of images needs a few
+   dozen malloc calls instead of several per image, and freeing the
+   tree is one free per chunk. An arena is used by one thread at a
+   time, it has no lock.  */
+
+#define ARENA_MIN_CHUNK 1024
+#define ARENA_MAX_CHUNK (64 * 1024)
+
+/* the data after the header is aligned like memory from malloc */
+typedef union arena_chunk_t {
+  union arena_chunk_t *next;
+  max_align_t align;
+} arena_chunk_t;
+
+struct arena_t {
+  arena_chunk_t *chunks;   /* all chunks, the current one first */
+  char *ptr;               /* free space of the current chunk */
+  char *end;
+  size_t chunk_size;       /* size of the next chunk */
+};
+
+arena_t *
+arena_create (void)
+{
+  arena_t *arena = calloc (1, sizeof (arena_t));
+
+  if (arena == NULL)
+    yapa_oom ();
+  arena->chunk_size = ARENA_MIN_CHUNK;
+  return arena;
+}
+
+static void *
+new_chunk (size_t size)
+{
+  arena_chunk_t *chunk = malloc (sizeof (arena_chunk_t) + size);
+
+  if (chunk == NULL)
+    yapa_oom ();
+  return chunk;
+}
+
+/* Returns size bytes with the given alignment, which is a power
+   of two.  */
+static void *
+arena_get (arena_t *arena, size_t size, size_t align)
+{
+  arena_chunk_t *chunk;
+  char *ptr;
+
+  ptr = (char *)(((size_t) arena->ptr + align - 1) & ~(align - 1));
+  if (arena->ptr != NULL && ptr <= arena->end &&
+      size <= (size_t)(arena->end - ptr))
+    {
+      arena->ptr = ptr + size;
+      return ptr;
+    }
+
+  /* a big block gets a chunk of its own, the free space of the
+     current one is used for the next allocations */
+  if (size > arena->chunk_size / 4)
+    {
+      chunk = new_chunk (size);
+      if (arena->chunks == NULL)
+	{
+	  chunk->next = NULL;
+	  arena->chunks = chunk;
+	}
+      else
+	{
+	  chunk->next = arena->chunks->next;
+	  arena->chunks->next = chunk;
+	}
+      return chunk + 1;
+    }
+
+  chunk = new_chunk (arena->chunk_size);
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->ptr = (char *)(chunk + 1) + size;
+  arena->end = (char *)(chunk + 1) + arena->chunk_size;
+  /* directories with many entries get bigger chunks */
+  if (arena->chunk_size < ARENA_MAX_CHUNK)
+    arena->chunk_size *= 2;
+
+  return chunk + 1;
+}
+
+/* Returns size bytes of zeroed memory like calloc.  */
+void *
+arena_alloc (arena_t *arena, size_t size)
+{
+  void *ptr = arena_get (arena, size, __alignof__ (arena_chunk_t));
+
+  memset (ptr, 0, size);
+  return ptr;
+}
+
+char *
+arena_strdup (arena_t *arena, const char *s)
+{
+  size_t len = strlen (s) + 1;
+
+  return memcpy (arena_get (arena, len, 1), s, len);
+}
+
+/* Free the arena and everything allocated from it.  */
+void
+arena_free (arena_t *arena)
+{
+  arena_chunk_t *chunk;
+
+  if (arena == NULL)
+    return;
+
+  chunk = arena->chunks;
+  while (chunk != NULL)
+    {
+      arena_chunk_t *next = chunk->next;
+
+      free (chunk);
+      chunk = next;
+    }
+  free (arena);
+}
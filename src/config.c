@@ -34,9 +34,55 @@ static config_t default_config = {
   thumbnail: 128,
   midnail: 640,
   sort_dir: 1,
-  sort_img: 1
+  sort_img: 1,
+  sort_dir_natural: 0,
+  sort_img_natural: 0,
+  exif_thumbnail: 1,
+  resample_filter: FILTER_LANCZOS3,
+  srcset_count: 0,
+  nail_format: NAIL_FORMAT_KEEP,
+  nail_quality: 85,
+  nail_progressive: 0,
+  nail_optimize: 0,
+  follow_symlinks: FOLLOW_ALWAYS
 };
 
+static const char *follow_names[] = {"never", "within-root", "always"};
+
+/* 3 and 4 are 1 and 2 in natural order.  */
+static void
+parse_sort_mode (const char *value, int *mode, int *natural)
+{
+  *mode = atoi (value);
+  *natural = (*mode >= 3);
+  if (*natural)
+    *mode -= 2;
+}
+
+/* Parse a comma separated list of nail sizes for srcset. */
+static void
+parse_srcset (config_t *config, char *value)
+{
+  char *cp, *saveptr;
+
+  config->srcset_count = 0;
+  for (cp = strtok_r (value, ",", &saveptr); cp != NULL;
+       cp = strtok_r (NULL, ",", &saveptr))
+    {
+      int size = atoi (cp);
+
+      if (size <= 0)
+	continue;
+      if (config->srcset_count == MAX_SRCSET)
+	{
+	  fprintf (stderr, "WARNING: only %d srcset sizes supported\n",
+		   MAX_SRCSET);
+	  break;
+	}
+      config->srcset[config->srcset_count++] = size;
+    }
+}
+
 config_t
 get_config (dir_l *dir, dir_l *parent)
 {
@@ -60,6 +106,7 @@ get_config (dir_l *dir, dir_l *parent)
     }
 
   /* open old file with order and labels */
+  count_syscall (SYS_OPEN);
   FILE *fp = fopen (filename, "r");
   free (filename);
   if (fp != NULL)
@@ -69,7 +116,7 @@ get_config (dir_l *dir, dir_l *parent)
 
       while (!feof (fp))
 	{
-	  char *cp, *value;
+	  char *cp, *value, *saveptr;
 	  ssize_t n = getline (&buf, &buflen, fp);
 
 	  cp = buf;
@@ -88,8 +135,8 @@ get_config (dir_l *dir, dir_l *parent)
 	  while (n > 0 && isspace ((int)cp[n]))
 	    cp[n--] = '\0';
 
-	  cp = strtok (cp, "\t :=");
-	  value = strtok (NULL, "\t :=");
+	  cp = strtok_r (cp, "\t :=", &saveptr);
+	  value = strtok_r (NULL, "\t :=", &saveptr);
 	  if (value)
 	    {
 	      /* XXX better error checking! */
@@ -106,9 +153,58 @@ get_config (dir_l *dir, dir_l *parent)
 	      else if (strcasecmp (cp, "midnail-size") == 0)
 		ret.midnail = atoi (value);
 	      else if (strcasecmp (cp, "sort-directory") == 0)
-		ret.sort_dir = atoi (value);
+		parse_sort_mode (value, &ret.sort_dir, &ret.sort_dir_natural);
 	      else if (strcasecmp (cp, "sort-images") == 0)
-		ret.sort_img = atoi (value);
+		parse_sort_mode (value, &ret.sort_img, &ret.sort_img_natural);
+	      else if (strcasecmp (cp, "exif-thumbnail") == 0)
+		ret.exif_thumbnail = atoi (value);
+	      else if (strcasecmp (cp, "nail-format") == 0)
+		{
+		  int format = get_nail_format (value);
+
+		  if (format < 0)
+		    fprintf (stderr, "WARNING: unknown nail format %s\n",
+			     value);
+		  else
+		    ret.nail_format = format;
+		}
+	      else if (strcasecmp (cp, "nail-quality") == 0)
+		{
+		  ret.nail_quality = atoi (value);
+		  if (ret.nail_quality < 1)
+		    ret.nail_quality = 1;
+		  else if (ret.nail_quality > 100)
+		    ret.nail_quality = 100;
+		}
+	      else if (strcasecmp (cp, "nail-progressive") == 0)
+		ret.nail_progressive = atoi (value);
+	      else if (strcasecmp (cp, "nail-optimize") == 0)
+		ret.nail_optimize = atoi (value);
+	      else if (strcasecmp (cp, "follow-symlinks") == 0)
+		{
+		  int i;
+
+		  for (i = FOLLOW_ALWAYS; i >= 0; i--)
+		    if (strcasecmp (value, follow_names[i]) == 0)
+		      break;
+		  if (i < 0)
+		    fprintf (stderr, "WARNING: unknown follow-symlinks value %s\n",
+			     value);
+		  else
+		    ret.follow_symlinks = i;
+		}
+	      else if (strcasecmp (cp, "srcset-sizes") == 0)
+		parse_srcset (&ret, value);
+	      else if (strcasecmp (cp, "resample-filter") == 0)
+		{
+		  int filter = get_resample_filter (value);
+
+		  if (filter < 0)
+		    fprintf (stderr, "WARNING: unknown resample filter %s\n",
+			     value);
+		  else
+		    ret.resample_filter = filter;
+		}
 	      else
 		fprintf (stderr, "WARNING: unknown option %s\n", cp);
 	    }
@@ -130,6 +226,7 @@ get_root_config (dir_l *dir)
     yapa_oom ();
 
   /* open old file with order and labels */
+  count_syscall (SYS_OPEN);
   FILE *fp = fopen (filename, "r");
   free (filename);
   if (fp != NULL)
@@ -166,7 +263,7 @@ get_root_config (dir_l *dir)
 	    {
 	      /* XXX better error checking! */
 	      if (strcasecmp (key, "gallery-name") == 0)
-		dir->label = strdup (cp);
+		dir->label = arena_strdup (dir_arena (dir), cp);
 	      else
 		fprintf (stderr, "WARNING: unknown option %s\n", key);
 	    }
@@ -220,8 +317,20 @@ create_root_config (const char *rootdir)
       fprintf (fp, "image-rows=%d\n", default_config.imagerows);
       fprintf (fp, "thumbnail-size=%d\n", default_config.thumbnail);
       fprintf (fp, "midnail-size=%d\n", default_config.midnail);
-      fprintf (fp, "sort-directory=%d\n", default_config.sort_dir);
-      fprintf (fp, "sort-images=%d\n", default_config.sort_img);
+      fprintf (fp, "sort-directory=%d\n", default_config.sort_dir +
+	       (default_config.sort_dir_natural ? 2 : 0));
+      fprintf (fp, "sort-images=%d\n", default_config.sort_img +
+	       (default_config.sort_img_natural ? 2 : 0));
+      fprintf (fp, "exif-thumbnail=%d\n", default_config.exif_thumbnail);
+      fprintf (fp, "resample-filter=%s\n",
+	       resample_filter_name (default_config.resample_filter));
+      fprintf (fp, "nail-format=%s\n",
+	       nail_format_name (default_config.nail_format));
+      fprintf (fp, "nail-quality=%d\n", default_config.nail_quality);
+      fprintf (fp, "nail-progressive=%d\n", default_config.nail_progressive);
+      fprintf (fp, "nail-optimize=%d\n", default_config.nail_optimize);
+      fprintf (fp, "follow-symlinks=%s\n",
+	       follow_names[default_config.follow_symlinks]);
       fclose (fp);
     }
   free (cp);
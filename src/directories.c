@@ -99,125 +99,203 @@ find_root_dir (const char *start_dir)
 }
 
 
+/* Create a directory entry of its own, like the root directory,
+   which is not part of the arena of a parent.  */
 dir_l *
-add_dir (dir_l **dir, const char *path, const char *dirname)
+new_dir (const char *path, const char *dirname)
 {
+  dir_l *new = calloc (1, sizeof (dir_l));
+
   if (debug_flag)
     printf ("ADD DIRECTORY: %s\n", path);
 
-  if (*dir == NULL)
+  if (new == NULL)
+    yapa_oom ();
+  if (dirname != NULL)
     {
-      *dir = calloc (1, sizeof (dir_l));
-      if (dirname != NULL)
-	(*dir)->name = strdup (dirname);
-      (*dir)->path = strdup (path);
-      return *dir;
+      new->name = strdup (dirname);
+      if (new->name == NULL)
+	yapa_oom ();
     }
-  else
+  new->path = intern_path (path);
+  new->allocated = 1;
+  return new;
+}
+
+/* Add a subdirectory to parent, the entry is allocated from the arena
+   of the parent. path is not copied, it has to be part of the arena
+   of the parent, too.  */
+dir_l *
+add_dir (dir_l *parent, const char *path, const char *dirname)
+{
+  arena_t *arena = dir_arena (parent);
+  dir_l *new = arena_alloc (arena, sizeof (dir_l));
+
+  if (debug_flag)
+    printf ("ADD DIRECTORY: %s\n", path);
+
+  new->name = arena_strdup (arena, dirname);
+  new->path = path;
+  new->parentdir = parent;
+  list_append (&parent->subdirs, new);
+  return new;
+}
+
+/* Returns the arena for the entries of dir, it is created with the
+   first one.  */
+arena_t *
+dir_arena (dir_l *dir)
+{
+  if (dir->arena == NULL)
+    dir->arena = arena_create ();
+  return dir->arena;
+}
+
+/* Returns the directory after dir in a depth first walk through the
+   tree below top, or NULL at the end. If descend is 0, the
+   subdirectories of dir are skipped. The way back up follows
+   parentdir, so the walk needs neither recursion nor a stack.  */
+dir_l *
+next_dir (const dir_l *top, dir_l *dir, int descend)
+{
+  if (descend && dir->subdirs.first != NULL)
+    return dir->subdirs.first;
+
+  while (dir != top)
     {
-      dir_l *ptr, *new = calloc (1, sizeof (dir_l));
+      if (dir->next != NULL)
+	return dir->next;
+      dir = dir->parentdir;
+    }
+  return NULL;
+}
 
-      ptr = *dir;
-      while (ptr->next != NULL)
-	ptr = ptr->next;
+/* Free the lists of a directory, their entries are part of the
+   arena.  */
+static void
+release_dir (dir_l *dir)
+{
+  list_clear (&dir->texts);
+  list_clear (&dir->html);
+  list_clear (&dir->gpx);
+  list_clear (&dir->images);
+  list_clear (&dir->subdirs);
+  if (dir->own_ignore)
+    {
+      ignore_t *ignore = dir->ignore;
 
-      ptr->next = new;
-      new->prev = ptr;
-      if (dirname != NULL)
-	new->name = strdup (dirname);
-      new->path = strdup (path);
-      return new;
+      dir->ignore = ignore->parent;
+      free_ignore (ignore);
+      dir->own_ignore = 0;
     }
+  arena_free (dir->arena);
+  dir->arena = NULL;
 }
 
 void
-free_dir (dir_l **dir)
+free_dir (dir_l *dir)
 {
   if (debug_flag)
-    printf ("FREE DIRECTORY: %s\n", (*dir)->path);
-
-  if ((*dir)->name != NULL)
-    free ((*dir)->name);
-  if ((*dir)->path != NULL)
-    free ((*dir)->path);
-  if ((*dir)->label != NULL)
-    free ((*dir)->label);
-
-  if ((*dir)->texts)
-    free_txt (&((*dir)->texts));
-  if ((*dir)->html)
-    free_txt (&((*dir)->html));
-  free_images (&((*dir)->images));
-
-  if ((*dir)->next != NULL)
-    free_dir (&((*dir)->next));
-  if ((*dir)->subdirs != NULL)
-    free_dir (&((*dir)->subdirs));
-  free (*dir);
+    printf ("FREE DIRECTORY: %s\n", dir->path);
+
+  free_dir_content (dir);
+  /* else name and the entry are part of the arena of the parent */
+  if (dir->allocated)
+    {
+      free (dir->name);
+      free (dir);
+    }
 }
 
-dir_l *
-get_and_delete_dir_entry (dir_l **dirs, const char *name)
+void
+free_dirs (list_t *dirs)
 {
-  dir_l *ptr = *dirs;
+  dir_l *dir = dirs->first;
 
-  while (ptr != NULL)
+  while (dir != NULL)
     {
-      if (strcmp (ptr->name, name) == 0)
-	{
-	  dir_l *ret = ptr;
+      dir_l *next = dir->next;
 
-	  if (ptr->prev == NULL) /* first image */
-	    {
-	      *dirs = (*dirs)->next;
-	      if (*dirs != NULL)
-		(*dirs)->prev = NULL;
-	      return ret;
-	    }
-	  else /* previous dir points to next dir */
-	    ptr->prev->next = ptr->next;
+      free_dir (dir);
+      dir = next;
+    }
+  list_clear (dirs);
+}
+
+/* Free everything of a directory except name, path and label, which
+   the index of the parent needs. The directories below are freed
+   from the bottom up, the entry of a directory is part of the arena
+   of its parent.  */
+void
+free_dir_content (dir_l *dir)
+{
+  dir_l *subdir = dir->subdirs.first;
+
+  while (subdir != NULL)
+    {
+      dir_l *parent, *next;
 
-	  if (ptr->next == NULL) /* last dir */
+      /* the first directory without subdirectories */
+      while (subdir->subdirs.first != NULL)
+	subdir = subdir->subdirs.first;
+
+      /* free it and all parents, for which it was the last one */
+      do
+	{
+	  parent = subdir->parentdir;
+	  next = subdir->next;
+	  if (debug_flag)
+	    printf ("FREE DIRECTORY: %s\n", subdir->path);
+	  release_dir (subdir);
+	  if (subdir->allocated)
 	    {
-	      ptr = ptr->prev;
-	      if (ptr != NULL)
-		ptr->next = NULL;
-	      return ret;
+	      free (subdir->name);
+	      free (subdir);
 	    }
-	  else /* next dir points to previous one */
-	    ptr->next->prev = ptr->prev;
-
-	  return ret;
+	  subdir = parent;
 	}
-      ptr = ptr->next;
+      while (next == NULL && subdir != dir);
+
+      subdir = next;
     }
-  return NULL;
+
+  release_dir (dir);
 }
 
 
 /* Go through the midnail and thumbnail directories and create
    list of available nails. */
 static void
-go_through_nails (image_l **images, const char *directory,
-		  void(*add_nail)(image_l **images, const char *,
-				  const char *, time_t))
+go_through_nails (arena_t *arena, list_t *images, const char *directory)
 {
-  DIR *dir = opendir (directory);
+  DIR *dir = open_dir (directory);
   struct dirent *d;
+  int fd;
 
   if (dir == NULL)
     return;
+  fd = dirfd (dir);
 
   if (debug_flag)
     printf ("TODO: Searching for existing nails in %s\n", directory);
 
-  while ((d = readdir (dir)) != NULL)
+  while ((d = read_dir (dir)) != NULL)
     {
-      char *buf;
-      struct stat st;
+      size_t len = strlen (d->d_name);
+      time_t mtime;
+      int type;
 
       if (debug_flag)
 	printf ("FOUND: %s ", d->d_name);
+      if (strncmp (d->d_name, ".new.", 5) == 0)
+	{
+	  /* left by a killed nail job, see save_nail. No job of this
+	     directory is running yet */
+	  unlinkat (fd, d->d_name, 0);
+	  if (debug_flag)
+	    printf ("==> DELETED\n");
+	  continue;
+	}
       if (d->d_name[0] == '.')
 	{
 	  if (debug_flag)
@@ -225,30 +303,30 @@ go_through_nails (image_l **images, const char *directory,
 	  continue;
 	}
 
-      if (asprintf (&buf, "%s/%s", directory, d->d_name) < 0)
-	yapa_oom ();
-
-      stat (buf, &st);
-      if (S_ISDIR(st.st_mode))
+      type = get_entry_type (fd, d);
+      if (type == DT_DIR)
 	printf ("==> Please remove wrong subdirectory\n");
-      else if (S_ISREG(st.st_mode))
+      else if (type == DT_REG)
 	{
-	  if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".jpg") == 0)
+	  if (len > 4 &&
+	      (strcasecmp (&d->d_name[len - 4], ".jpg") == 0 ||
+	       strcasecmp (&d->d_name[len - 4], ".png") == 0 ||
+	       strcasecmp (&d->d_name[len - 5], ".webp") == 0 ||
+	       strcasecmp (&d->d_name[len - 5], ".avif") == 0))
 	    {
+	      if (stat_entry (fd, d->d_name, NULL, &mtime) != 0)
+		{
+		  if (debug_flag)
+		    printf ("==> vanished\n");
+		  continue;
+		}
 	      if (debug_flag)
 		printf ("==> ");
-	      add_nail (images, directory, d->d_name, st.st_mtime);
-
-	    }
-	  else if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".png") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> Add ");
-	      add_nail (images, directory, d->d_name, st.st_mtime);
+	      add_nail (arena, images, directory, d->d_name, mtime);
 	    }
 	  else
 	    {
-	      unlink (buf);
+	      unlinkat (fd, d->d_name, 0);
 	      if (debug_flag)
 		printf ("==> DELETED\n");
 	      else
@@ -258,110 +336,14 @@ go_through_nails (image_l **images, const char *directory,
 	}
       else
 	{
-	  unlink (buf);
+	  unlinkat (fd, d->d_name, 0);
 	  printf ("==> DELETED\n");
 	}
-      free (buf);
     }
 
   closedir (dir);
 }
 
-static dir_l *
-sort_dir (dir_l *dir)
-{
-  dir_l *new = dir;
-
-  if (debug_flag)
-    {
-      printf ("=> Sort Directories\n");
-      dir_l *dbg = dir;
-      while (dbg != NULL)
-	{
-	  printf ("==> %s\n", dbg->name);
-	  dbg = dbg->next;
-	}
-    }
-
-  dir = dir->next;
-  new->prev = NULL;
-  new->next = NULL;
-
-  while (dir != NULL)
-    {
-      dir_l *tmp = new;
-
-      while (tmp != NULL)
-	{
-	  int cmp = strcmp (tmp->name, dir->name);
-
-	  /* dir->name should come before tmp->name */
-	  if (cmp >= 0)
-	    {
-	      if (tmp->prev == NULL)
-		{
-		  new = dir;
-		  dir = dir->next;
-		  new->prev = NULL;
-		  new->next = tmp;
-		  tmp->prev = new;
-		}
-	      else
-		{
-		  dir_l *next = dir->next;
-
-		  tmp->prev->next = dir;
-		  dir->prev = tmp->prev;
-		  tmp->prev = dir;
-		  dir->next = tmp;
-		  dir = next;
-		}
-	      break;
-	    }
-	  /* dir->name should come after tmp->name */
-	  else /* if (cmp < 0) */
-	    {
-	      if (tmp->next == NULL)
-		{
-		  dir_l *next = dir->next;
-
-		  tmp->next = dir;
-		  tmp->next->prev = tmp;
-		  tmp->next->next = NULL;
-		  dir = next;
-		  break;
-		}
-	      else
-		tmp = tmp->next;
-	    }
-	}
-
-      /* dir = dir->next; */
-    }
-
-  if (debug_flag)
-    {
-      printf ("=> Result\n");
-      dir_l *dbg = new;
-      dir_l *back = NULL;
-
-      while (dbg != NULL)
-	{
-	  printf ("==> %s\n", dbg->name);
-	  if (dbg->next == NULL)
-	    back = dbg;
-	  dbg = dbg->next;
-	}
-      while (back != NULL)
-	{
-	  printf ("==> %s\n", back->name);
-	  back = back->prev;
-	}
-    }
-
-  return new;
-}
-
 static void
 sort_directories (dir_l *dir)
 {
@@ -380,7 +362,7 @@ sort_directories (dir_l *dir)
 	yapa_oom ();
     }
 
-  if (dir->subdirs == NULL)
+  if (dir->subdirs.first == NULL)
     {
       unlink (filename); /* Delete old crap */
       free (filename);
@@ -388,14 +370,17 @@ sort_directories (dir_l *dir)
     }
 
   /* open old file with order and labels */
+  count_syscall (SYS_OPEN);
   FILE *fp = fopen (filename, "r");
   if (fp != NULL)
     {
-      dir_l *newlist = NULL, *curr_new = NULL;
+      list_t newlist = LIST_INIT;
+      dir_l *entry;
       char *buf = NULL;
       size_t buflen = 0;
       struct stat st;
 
+      count_syscall (SYS_STAT);
       stat (filename, &st);
       dir->directory_mtime = st.st_mtime;
 
@@ -424,47 +409,42 @@ sort_directories (dir_l *dir)
 	  if (ptr != NULL)
 	    *ptr++='\0';
 
-	  dir_l *entry = get_and_delete_dir_entry (&dir->subdirs, cp);
+	  entry = list_remove (&dir->subdirs, cp);
 	  if (entry == NULL ||
-	      (entry->subdirs == NULL && entry->images == NULL))
+	      (entry->subdirs.first == NULL && entry->images.first == NULL &&
+	       !entry->shallow))
 	    {
 	      if (debug_flag)
 		printf ("===> OBSOLETE DIR=%s, recreate all html pages\n", cp);
 	      dir->force_html = 1;
 	      need_to_save = 1;
+	      if (entry != NULL)
+		free_dir (entry);
 	    }
 	  else
 	    {
 	      if (ptr)
-		entry->label = strdup (ptr);
-	      if (newlist == NULL)
 		{
-		  newlist = entry;
-		  curr_new = entry;
-		  newlist->prev = NULL;
-		  newlist->next = NULL;
-		}
-	      else
-		{
-		  curr_new->next = entry;
-		  entry->prev = curr_new;
-		  entry->next = NULL;
-		  curr_new = entry;
+		  /* read_directory_labels could have set it already */
+		  if (entry->label == NULL || strcmp (entry->label, ptr) != 0)
+		    entry->label = arena_strdup (dir_arena (dir), ptr);
 		}
+	      list_append (&newlist, entry);
 	    }
 	}
-      if (dir->subdirs != NULL)
+      if (dir->subdirs.first != NULL)
 	{
 	  int first = 0;
 
 	  if (dir->config.sort_dir == 1) /* Add sorted directories at the
 					    end of existing list */
-	    dir->subdirs = sort_dir (dir->subdirs);
+	    list_sort (&dir->subdirs, dir->config.sort_dir_natural);
 
-	  while (dir->subdirs != NULL)
+	  while ((entry = dir->subdirs.first) != NULL)
 	    {
-	      if (dir->subdirs->subdirs != NULL ||
-		  dir->subdirs->images != NULL)
+	      list_unlink (&dir->subdirs, entry);
+	      if (entry->subdirs.first != NULL ||
+		  entry->images.first != NULL || entry->shallow)
 		{
 		  if (!first)
 		    {
@@ -476,21 +456,18 @@ sort_directories (dir_l *dir)
 		    }
 
 		  if (debug_flag)
-		    printf ("=> FOUND %s\n", dir->subdirs->name);
-		  curr_new->next = dir->subdirs;
-		  dir->subdirs->prev = curr_new;
-		  dir->subdirs = dir->subdirs->next;
-		  curr_new->next->next = NULL;
-		  curr_new = curr_new->next;
+		    printf ("=> FOUND %s\n", entry->name);
+		  list_append (&newlist, entry);
 		}
 	      else
 		{
 		  if (debug_flag)
-		    printf ("FOUND EMPTY DIR: %s\n", dir->subdirs->name);
-		  dir->subdirs = dir->subdirs->next;
+		    printf ("FOUND EMPTY DIR: %s\n", entry->name);
+		  free_dir (entry);
 		}
 	    }
 	}
+      list_clear (&dir->subdirs);
       dir->subdirs = newlist;
 
       free (buf);
@@ -503,20 +480,20 @@ sort_directories (dir_l *dir)
 
       if (dir->config.sort_dir == 1) /* Add sorted directories at the
 					end of existing list */
-	dir->subdirs = sort_dir (dir->subdirs);
+	list_sort (&dir->subdirs, dir->config.sort_dir_natural);
     }
 
   /* Save new file with order and labels */
-  if (dir->subdirs != NULL && need_to_save)
+  if (dir->subdirs.first != NULL && need_to_save)
     {
       /* sort all directories */
       if (dir->config.sort_dir == 2)
-	dir->subdirs = sort_dir (dir->subdirs);
+	list_sort (&dir->subdirs, dir->config.sort_dir_natural);
 
       fp = fopen (filename, "w");
       if (fp == NULL)
 	abort ();
-      dir_l *ptr = dir->subdirs;
+      dir_l *ptr = dir->subdirs.first;
       while (ptr)
 	{
 	  fprintf (fp, "%s", ptr->name);
@@ -530,140 +507,364 @@ sort_directories (dir_l *dir)
   free (filename);
 }
 
-static void
-update_nails (dir_l *dir)
+/* Set the labels of the subdirectories from yapa/directories without
+   changing it, for directories whose pages are created by somebody
+   else.  */
+void
+read_directory_labels (dir_l *dir)
 {
-  char *cp;
-  image_l *midnails = NULL, *thumbnails = NULL;
-  image_l *images = dir->images;
+  char *filename, *buf = NULL;
+  size_t buflen = 0;
+  struct stat st;
+  FILE *fp;
 
-  if (dir->name == NULL) /* root directory */
+  if (dir->name == NULL)
     {
-      if (debug_flag)
-	printf ("DIR=ROOT [%s]\n", dir->path);
-
-      if (asprintf (&cp, "%s/yapa/midnails", dir->path) < 0)
-	yapa_oom ();
-      go_through_nails (&midnails, cp, add_midnail);
-      free (cp);
-
-      if (asprintf (&cp, "%s/yapa/thumbnails", dir->path) < 0)
+      if (asprintf (&filename, "%s/yapa/directories", dir->path) < 0)
 	yapa_oom ();
-
-      go_through_nails (&thumbnails, cp, add_thumbnail);
-      free (cp);
     }
   else
     {
-      if (debug_flag)
-	printf ("DIR=%s [%s]\n", dir->name, dir->path);
-
-      if (asprintf (&cp, "%s/%s/yapa/midnails", dir->path, dir->name) < 0)
+      if (asprintf (&filename, "%s/%s/yapa/directories",
+		    dir->path, dir->name) < 0)
 	yapa_oom ();
-      go_through_nails (&midnails, cp, add_midnail);
-      free (cp);
+    }
 
-      if (asprintf (&cp, "%s/%s/yapa/thumbnails", dir->path, dir->name) < 0)
-	yapa_oom ();
-      go_through_nails (&thumbnails, cp, add_thumbnail);
-      free (cp);
+  count_syscall (SYS_OPEN);
+  fp = fopen (filename, "r");
+  free (filename);
+  if (fp == NULL)
+    return;
+
+  if (fstat (fileno (fp), &st) == 0)
+    dir->directory_mtime = st.st_mtime;
+
+  while (1)
+    {
+      ssize_t n = getline (&buf, &buflen, fp);
+      char *cp = buf, *ptr;
+      dir_l *entry;
+
+      if (n < 1)
+	break;
+
+      while (isspace ((int)*cp))
+	++cp;
+      n = strlen (cp);
+      while (n > 0 && isspace ((int)cp[n - 1]))
+	cp[--n] = '\0';
+
+      ptr = strchr (cp, '@');
+      if (ptr == NULL)
+	continue;
+      *ptr++ = '\0';
+
+      entry = list_lookup (&dir->subdirs, cp);
+      if (entry != NULL &&
+	  (entry->label == NULL || strcmp (entry->label, ptr) != 0))
+	entry->label = arena_strdup (dir_arena (dir), ptr);
     }
 
-  /* make sure we have a midnail and a thumbnail for
-     every image */
-  while (images != NULL)
+  free (buf);
+  fclose (fp);
+}
+
+/* Fill nails with all nails a directory needs and return the
+   number of them.  */
+static int
+get_nail_list (dir_l *dir, nail_t *nails)
+{
+  int count = 0, i, j;
+
+  strcpy (nails[count].nailname, "midnails");
+  nails[count++].size = dir->config.midnail;
+  strcpy (nails[count].nailname, "thumbnails");
+  nails[count++].size = dir->config.thumbnail;
+
+  /* additional sizes for srcset, the midnail or thumbnail is used
+     if it has the same size */
+  for (i = 0; i < dir->config.srcset_count; i++)
     {
-      if (debug_flag)
-	printf ("===>IMAGE=%s\n", images->name);
+      int size = dir->config.srcset[i];
+
+      if (size == dir->config.midnail)
+	continue;
+      for (j = 1; j < count; j++)
+	if (nails[j].size == size)
+	  break;
+      if (j < count)
+	continue;
+
+      snprintf (nails[count].nailname, sizeof (nails[count].nailname),
+		"nails-%d", size);
+      nails[count++].size = size;
+    }
+
+  return count;
+}
 
-      image_l *nail = get_and_delete_image_entry (&midnails, images->name);
-      if (nail == NULL || images->mtime > nail->mtime || force_nail_flag)
-	create_nail (images->srcdir, images->dstdir,  images->name,
-		     dir->config.midnail, "midnails");
-      if (nail)
+/* Remove yapa/nails-<size> directories of srcset sizes, which are
+   no longer configured. Returns the number of removed directories.  */
+static int
+remove_obsolete_nail_dirs (const char *yapadir, nail_t *nails, int count)
+{
+  DIR *dir = open_dir (yapadir);
+  struct dirent *d;
+  path_t *path;
+  int i, removed = 0;
+
+  if (dir == NULL)
+    return 0;
+
+  path = path_get ();
+  while ((d = read_dir (dir)) != NULL)
+    {
+      DIR *nail_dir;
+      struct dirent *n;
+
+      if (strncmp (d->d_name, "nails-", 6) != 0)
+	continue;
+      for (i = 0; i < count; i++)
+	if (strcmp (d->d_name, nails[i].nailname) == 0)
+	  break;
+      if (i < count)
+	continue;
+
+      path_set (path, yapadir);
+      nail_dir = open_dir (path_add (path, d->d_name));
+      if (nail_dir != NULL)
 	{
-	  free (nail->name);
-	  free (nail->srcdir);
-	  free (nail->dstdir);
-	  free (nail);
+	  printf (_("Delete obsolete nails %s\n"), d->d_name);
+	  while ((n = read_dir (nail_dir)) != NULL)
+	    {
+	      if (n->d_name[0] == '.')
+		continue;
+	      unlinkat (dirfd (nail_dir), n->d_name, 0);
+	    }
+	  closedir (nail_dir);
+	  rmdir (path->str);
+	  removed++;
 	}
-      nail = get_and_delete_image_entry (&thumbnails, images->name);
-      if (nail == NULL || images->mtime > nail->mtime || force_nail_flag)
-	create_nail (images->srcdir, images->dstdir, images->name,
-		     dir->config.thumbnail, "thumbnails");
-      if (nail)
+    }
+  closedir (dir);
+  path_put (path);
+
+  return removed;
+}
+
+/* Nails created by a version without yapa/nails have no recorded
+   parameters. Only nails with the configured size are kept, the
+   other parameters cannot be checked.  */
+static int
+nail_has_size (const image_l *img, const image_l *nail, int size)
+{
+  path_t *path = path_get ();
+  unsigned int width, height, nail_width, nail_height;
+  unsigned int expected, actual;
+  int ret = 0;
+
+  path_set (path, img->srcdir);
+  if (get_image_dimensions (path_add (path, img->name), &width, &height) == 0)
+    {
+      get_nail_size (width, height, size, &nail_width, &nail_height);
+      /* the nail could be rotated, see orient_image */
+      expected = nail_width > nail_height ? nail_width : nail_height;
+
+      path_set (path, nail->srcdir);
+      if (get_image_dimensions (path_add (path, nail->name),
+				&nail_width, &nail_height) == 0)
 	{
-	  free (nail->name);
-	  free (nail->srcdir);
-	  free (nail->dstdir);
-	  free (nail);
+	  actual = nail_width > nail_height ? nail_width : nail_height;
+	  /* older versions could round differently */
+	  ret = (actual + 1 >= expected && actual <= expected + 1);
 	}
-      images = images->next;
     }
 
-  /* if midnails are left, delete them. */
-  while (midnails != NULL)
-    {
-      image_l *tmp;
+  path_put (path);
+  return ret;
+}
 
-      if (debug_flag)
-	printf ("===>MIDNAIL=%s => DELETE\n", midnails->name);
+static void
+update_nails (dir_l *dir)
+{
+  path_t *yapadir = path_get (), *path = path_get (), *nailbuf = path_get ();
+  nail_t nails[MAX_NAILS];
+  char *params[MAX_NAILS];
+  list_t existing[MAX_NAILS];
+  int recorded[MAX_NAILS];  /* the manifest has entries of this nail */
+  arena_t *arena = arena_create ();  /* existing nails and manifests */
+  image_l *images = dir->images.first;
+  list_t manifest = LIST_INIT;
+  manifest_t *new_manifest;
+  int phase, count, i, unchanged = 0, new_entries = 0;
+
+  if (debug_flag)
+    {
+      if (dir->name == NULL) /* root directory */
+	printf ("DIR=ROOT [%s]\n", dir->path);
       else
-	printf ("Delete obsolete midnail %s\n", midnails->name);
-      if (asprintf (&cp, "%s/%s", midnails->srcdir, midnails->name) < 0)
-	yapa_oom ();
-      unlink (cp);
-      free (cp);
-      tmp = midnails;
-      midnails = midnails->next;
-      free (tmp->name);
-      free (tmp->srcdir);
-      free (tmp->dstdir);
-      free (tmp);
+	printf ("DIR=%s [%s]\n", dir->name, dir->path);
     }
 
-  /* if thumbnails are left, delete them. */
-  while (thumbnails != NULL)
+  phase = set_stats_phase (PHASE_NAILS);
+  count = get_nail_list (dir, nails);
+
+  path_dir (yapadir, dir);
+  path_add (yapadir, "yapa");
+  read_manifest (arena, yapadir->str, &manifest);
+  new_manifest = create_manifest (yapadir->str);
+  /* the pages list the nails of all srcset sizes */
+  if (remove_obsolete_nail_dirs (yapadir->str, nails, count) > 0)
+    dir->force_html = 1;
+
+  for (i = 0; i < count; i++)
     {
-      image_l *tmp;
+      memset (&existing[i], 0, sizeof (list_t));
+      recorded[i] = 0;
+      params[i] = get_nail_params (&nails[i], &dir->config);
+
+      path_set (path, yapadir->str);
+      path_add (path, nails[i].nailname);
+      go_through_nails (arena, &existing[i], arena_strdup (arena, path->str));
+    }
+
+  /* make sure we have every nail for every image. All outdated
+     nails of one image are created from one decode of it. */
+  while (images != NULL)
+    {
+      nail_t todo[MAX_NAILS];
+      int todo_count = 0;
+      const char *nailfile = get_nail_filename (nailbuf, images->name,
+						&dir->config);
 
       if (debug_flag)
-	printf ("===>THUMBNAIL=%s => DELETE\n", thumbnails->name);
-      else
-	printf ("Delete obsolete thumbnail %s\n", thumbnails->name);
-      if (asprintf (&cp, "%s/%s", thumbnails->dstdir, thumbnails->name) < 0)
-	yapa_oom ();
-      unlink (cp);
-      free (cp);
-      tmp = thumbnails;
-      thumbnails = thumbnails->next;
-      free (tmp->name);
-      free (tmp->srcdir);
-      free (tmp->dstdir);
-      free (tmp);
+	printf ("===>IMAGE=%s\n", images->name);
+
+      for (i = 0; i < count; i++)
+	{
+	  image_l *nail = list_remove (&existing[i], nailfile);
+	  const char *old_params =
+	    get_manifest_entry (&manifest, nails[i].nailname, images->name);
+
+	  if (nail == NULL || images->mtime > nail->mtime || force_nail_flag)
+	    todo[todo_count++] = nails[i];
+	  else if (old_params != NULL && strcmp (old_params, params[i]) != 0)
+	    {
+	      if (debug_flag)
+		printf ("===>NAIL=%s/%s => PARAMS CHANGED (%s)\n",
+			nails[i].nailname, images->name, old_params);
+	      todo[todo_count++] = nails[i];
+	    }
+	  /* with yapa/nails a nail without entry was not created by a
+	     finished job, without it is from an older version */
+	  else if (old_params == NULL &&
+		   (manifest.first != NULL ||
+		    !nail_has_size (images, nail, nails[i].size)))
+	    {
+	      if (debug_flag)
+		printf ("===>NAIL=%s/%s => NOT RECORDED\n",
+			nails[i].nailname, images->name);
+	      todo[todo_count++] = nails[i];
+	      dir->force_html = 1;
+	    }
+
+	  /* the pages show the size and name of the nails, which
+	     depend on the parameters */
+	  if (old_params != NULL && strcmp (old_params, params[i]) != 0)
+	    dir->force_html = 1;
+
+	  if (old_params != NULL)
+	    recorded[i] = 1;
+	  if (old_params != NULL && strcmp (old_params, params[i]) == 0)
+	    ++unchanged;
+	  ++new_entries;
+	  add_manifest_entry (new_manifest->arena, &new_manifest->entries,
+			      nails[i].nailname, images->name, params[i]);
+	}
+
+      add_nail_job (images->srcdir, images->dstdir, images->name,
+		    todo, todo_count, &dir->config, new_manifest);
+
+      images = images->next;
     }
+
+  /* a new srcset size is not listed on the existing pages yet */
+  if (manifest.first != NULL)
+    for (i = 0; i < count; i++)
+      if (!recorded[i])
+	dir->force_html = 1;
+
+  /* if nails are left, delete them. */
+  for (i = 0; i < count; i++)
+    {
+      image_l *nail;
+
+      while ((nail = existing[i].first) != NULL)
+	{
+	  if (debug_flag)
+	    printf ("===>NAIL=%s/%s => DELETE\n", nails[i].nailname,
+		    nail->name);
+	  else
+	    printf ("Delete obsolete nail %s/%s\n", nails[i].nailname,
+		    nail->name);
+	  path_set (path, nail->srcdir);
+	  unlink (path_add (path, nail->name));
+	  list_unlink (&existing[i], nail);
+	}
+      list_clear (&existing[i]);
+    }
+
+  /* rewrite yapa/nails only if something changed, after the running
+     nail jobs of the directory are finished */
+  new_manifest->changed = ((int) manifest.count != new_entries ||
+			   unchanged != new_entries);
+  release_manifest (new_manifest);
+  list_clear (&manifest);
+  arena_free (arena);
+  for (i = 0; i < count; i++)
+    free (params[i]);
+  path_put (nailbuf);
+  path_put (path);
+  path_put (yapadir);
+  set_stats_phase (phase);
 }
 
+/* Create the nails and html pages of one directory.  */
 void
-update_html (dir_l *dir)
+update_directory (dir_l *dir)
 {
   unsigned long long imgnumber;
   image_l *images;
-  dir_l *subdirs;
   txt_l *tptr;
+  char *directory = NULL;
+
+  if (use_locks)
+    {
+      if (dir->name == NULL)
+	directory = strdup (dir->path);
+      else if (asprintf (&directory, "%s/%s", dir->path, dir->name) < 0)
+	directory = NULL;
+      if (directory == NULL)
+	yapa_oom ();
+
+      if (!lock_directory (directory))
+	{
+	  printf (_("Skipping directory %s, locked by another process\n"),
+		  dir->name ? dir->name : "root");
+	  free (directory);
+	  /* the pages of the subdirectories need the labels */
+	  read_directory_labels (dir);
+	  return;
+	}
+    }
 
   if (!debug_flag)
     printf ("Entering directory %s\n", dir->name ? dir->name : "root");
 
   tptr = get_and_delete_html_entry (&dir->html, "index");
   if (tptr != NULL)
-    {
-      dir->mtime = tptr->mtime;
-      free (tptr->name);
-      free (tptr->path);
-      free (tptr);
-    }
-  tptr = get_txt_entry (dir->texts, "directory");
+    dir->mtime = tptr->mtime;
+  tptr = get_txt_entry (&dir->texts, "directory");
   if (tptr)
     dir->descr_mtime = tptr->mtime;
 
@@ -671,13 +872,34 @@ update_html (dir_l *dir)
   sort_gpx (dir);
   sort_directories (dir);
 
+  /* the lock could have been taken over by a process reclaiming a
+     stale one */
+  if (directory != NULL && !verify_lock (directory))
+    {
+      free (directory);
+      read_directory_labels (dir);
+      return;
+    }
+
   update_nails (dir);
 
+  /* nails are replaced atomically, so the jobs started don't harm,
+     but the pages are left to the new owner of the lock */
+  if (directory != NULL && !verify_lock (directory))
+    {
+      free (directory);
+      read_directory_labels (dir);
+      return;
+    }
+  free (directory);
+
   /* Create html for every image */
-  images = dir->images;
+  images = dir->images.first;
   imgnumber = 0;
   while (images != NULL)
     {
+      renew_locks ();
+
       if (debug_flag)
 	printf ("===>HTML page for %s, html=%lu, img=%lu\n",
 		images->name, (unsigned long)images->mtime,
@@ -694,11 +916,43 @@ update_html (dir_l *dir)
     }
 
   create_html_index (dir);
+}
 
-  subdirs = dir->subdirs;
-  while (subdirs != NULL)
+void
+update_html (dir_l *dir)
+{
+  const dir_l *top = dir;
+
+  while (dir != NULL)
     {
-      update_html (subdirs);
-      subdirs = subdirs->next;
+      /* the pages of a directory reached twice exist already */
+      if (!dir->shallow)
+	update_directory (dir);
+
+      /* after update_directory, which removes empty subdirectories */
+      dir = next_dir (top, dir, !dir->shallow);
     }
 }
+
+/* Update only a subtree given on the command line. Of its ancestors
+   only the directory itself is updated, their other subdirectories
+   were not scanned.  */
+void
+update_subtree (dir_l *dir)
+{
+  while (dir != NULL && dir->ancestor)
+    {
+      dir_l *subdir;
+
+      /* sorts the subdirectories, too */
+      update_directory (dir);
+
+      subdir = dir->subdirs.first;
+      while (subdir != NULL && subdir->shallow)
+	subdir = subdir->next;
+      dir = subdir;
+    }
+
+  if (dir != NULL)
+    update_html (dir);
+}
@@ -0,0 +1,312 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#define X_DISPLAY_MISSING
+#include <Imlib2.h>
+#ifdef HAVE_LIBWEBP
+#include <webp/encode.h>
+#endif
+#ifdef HAVE_LIBAVIF
+#include <avif/avif.h>
+#endif
+
+#include "main.h"
+
+/* Encoders for the nails. The format is selected with nail-format
+   in yapa/config, "keep" writes the nails in the format of the
+   image. If yapa was built without the library for a format, imlib2
+   is tried instead.  */
+
+static const struct {
+  const char *name;
+  const char *extension; /* appended to the image name */
+} formats[] = {
+  [NAIL_FORMAT_KEEP] = { "keep", NULL },
+  [NAIL_FORMAT_JPEG] = { "jpeg", ".jpg" },
+  [NAIL_FORMAT_WEBP] = { "webp", ".webp" },
+  [NAIL_FORMAT_AVIF] = { "avif", ".avif" },
+};
+#define NR_FORMATS (int)(sizeof (formats) / sizeof (formats[0]))
+
+int
+get_nail_format (const char *name)
+{
+  int i;
+
+  for (i = 0; i < NR_FORMATS; i++)
+    if (strcasecmp (formats[i].name, name) == 0)
+      return i;
+  if (strcasecmp (name, "jpg") == 0)
+    return NAIL_FORMAT_JPEG;
+  return -1;
+}
+
+const char *
+nail_format_name (int format)
+{
+  if (format < 0 || format >= NR_FORMATS)
+    return "unknown";
+  return formats[format].name;
+}
+
+static int
+has_extension (const char *fname, const char *ext)
+{
+  size_t len = strlen (fname), extlen = strlen (ext);
+
+  return len > extlen && strcasecmp (&fname[len - extlen], ext) == 0;
+}
+
+/* Format the nails of an image are written in.  */
+static int
+get_format (const char *fname, const config_t *config)
+{
+  if (config->nail_format != NAIL_FORMAT_KEEP)
+    return config->nail_format;
+  if (has_extension (fname, ".jpg") || has_extension (fname, ".jpeg"))
+    return NAIL_FORMAT_JPEG;
+  return NAIL_FORMAT_KEEP;
+}
+
+/* Name of the nail files of an image: the name of the image, if the
+   nail has the same format, else the extension of the format gets
+   appended. Returns fname or the name built in nailfile.  */
+const char *
+get_nail_filename (path_t *nailfile, const char *fname,
+		   const config_t *config)
+{
+  int format = get_format (fname, config);
+
+  if (format == NAIL_FORMAT_KEEP ||
+      has_extension (fname, formats[format].extension) ||
+      (format == NAIL_FORMAT_JPEG && has_extension (fname, ".jpeg")))
+    return fname;
+
+  path_set (nailfile, fname);
+  return path_append (nailfile, formats[format].extension);
+}
+
+#if defined(HAVE_LIBWEBP) || defined(HAVE_LIBAVIF)
+static int
+write_file (const char *filename, const uint8_t *data, size_t size)
+{
+  FILE *fp = fopen (filename, "wb");
+
+  if (fp == NULL)
+    return -1;
+
+  if (fwrite (data, 1, size, fp) != size)
+    {
+      fclose (fp);
+      unlink (filename);
+      return -1;
+    }
+  if (fclose (fp) != 0)
+    {
+      unlink (filename);
+      return -1;
+    }
+  return 0;
+}
+#endif
+
+#ifdef HAVE_LIBWEBP
+static int
+save_webp (const char *filename, const uint32_t *data, unsigned int width,
+	   unsigned int height, const config_t *config)
+{
+  WebPConfig wconfig;
+  WebPPicture picture;
+  WebPMemoryWriter writer;
+  int ret = -1;
+
+  if (!WebPConfigInit (&wconfig) || !WebPPictureInit (&picture))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  wconfig.quality = config->nail_quality;
+  /* slower, but better compression */
+  wconfig.method = config->nail_optimize ? 6 : 4;
+
+  /* libwebp uses the same ARGB layout as imlib2 */
+  picture.use_argb = 1;
+  picture.width = width;
+  picture.height = height;
+  picture.argb = (uint32_t *) data;
+  picture.argb_stride = width;
+
+  WebPMemoryWriterInit (&writer);
+  picture.writer = WebPMemoryWrite;
+  picture.custom_ptr = &writer;
+
+  if (WebPEncode (&wconfig, &picture))
+    ret = write_file (filename, writer.mem, writer.size);
+  else
+    errno = EIO;
+
+  WebPPictureFree (&picture);
+  WebPMemoryWriterClear (&writer);
+
+  return ret;
+}
+#endif
+
+#ifdef HAVE_LIBAVIF
+static int
+save_avif (const char *filename, const uint32_t *data, unsigned int width,
+	   unsigned int height, int has_alpha, const config_t *config)
+{
+  avifImage *image;
+  avifRGBImage rgb;
+  avifEncoder *encoder = NULL;
+  avifRWData output = AVIF_DATA_EMPTY;
+  int ret = -1;
+
+  image = avifImageCreate (width, height, 8, AVIF_PIXEL_FORMAT_YUV420);
+  if (image == NULL)
+    yapa_oom ();
+
+  avifRGBImageSetDefaults (&rgb, image);
+#ifdef WORDS_BIGENDIAN
+  rgb.format = AVIF_RGB_FORMAT_ARGB;
+#else
+  rgb.format = AVIF_RGB_FORMAT_BGRA;
+#endif
+  rgb.ignoreAlpha = has_alpha ? AVIF_FALSE : AVIF_TRUE;
+  rgb.pixels = (uint8_t *) data;
+  rgb.rowBytes = width * sizeof (uint32_t);
+
+  errno = EIO;
+  if (avifImageRGBToYUV (image, &rgb) != AVIF_RESULT_OK)
+    goto out;
+
+  encoder = avifEncoderCreate ();
+  if (encoder == NULL)
+    yapa_oom ();
+#if AVIF_VERSION_MAJOR >= 1
+  encoder->quality = config->nail_quality;
+  encoder->qualityAlpha = config->nail_quality;
+#else
+  encoder->minQuantizer = encoder->maxQuantizer =
+    (100 - config->nail_quality) * AVIF_QUANTIZER_WORST_QUALITY / 100;
+#endif
+  encoder->speed = config->nail_optimize ? 4 : 8;
+
+  if (avifEncoderWrite (encoder, image, &output) == AVIF_RESULT_OK)
+    ret = write_file (filename, output.data, output.size);
+
+ out:
+  avifRWDataFree (&output);
+  if (encoder != NULL)
+    avifEncoderDestroy (encoder);
+  avifImageDestroy (image);
+
+  return ret;
+}
+#endif
+
+static int
+save_imlib (const char *filename, const char *format, int quality)
+{
+  Imlib_Load_Error error;
+
+  if (format != NULL)
+    imlib_image_set_format (format);
+  imlib_image_attach_data_value ("quality", NULL, quality, NULL);
+
+  imlib_save_image_with_error_return (filename, &error);
+  if (error == IMLIB_LOAD_ERROR_NONE)
+    return 0;
+
+  if (error == IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT)
+    errno = ENOENT;
+  else
+    {
+      if (debug_flag)
+	printf ("========>IMLIB2: error code %d\n", error);
+      errno = EIO;
+    }
+  return -1;
+}
+
+/* Write the current imlib2 image as nail of the image fname to
+   filename. Returns 0 on success, -1 on error with errno set.  */
+int
+encode_nail (const char *filename, const char *fname,
+	     const config_t *config)
+{
+  int format = get_format (fname, config);
+#if defined(HAVE_LIBJPEG) || defined(HAVE_LIBWEBP) || defined(HAVE_LIBAVIF)
+  const uint32_t *data = imlib_image_get_data_for_reading_only ();
+  unsigned int width = imlib_image_get_width ();
+  unsigned int height = imlib_image_get_height ();
+#endif
+
+  switch (format)
+    {
+    case NAIL_FORMAT_JPEG:
+#ifdef HAVE_LIBJPEG
+      return save_jpeg (filename, data, width, height, config->nail_quality,
+			config->nail_progressive, config->nail_optimize);
+#else
+      return save_imlib (filename, "jpeg", config->nail_quality);
+#endif
+    case NAIL_FORMAT_WEBP:
+#ifdef HAVE_LIBWEBP
+      if (!imlib_image_has_alpha ())
+	{
+	  /* the alpha channel of images without alpha is undefined */
+	  uint32_t *opaque = malloc ((size_t) width * height *
+				     sizeof (uint32_t));
+	  size_t i;
+	  int ret;
+
+	  if (opaque == NULL)
+	    yapa_oom ();
+	  for (i = 0; i < (size_t) width * height; i++)
+	    opaque[i] = data[i] | 0xff000000;
+	  ret = save_webp (filename, opaque, width, height, config);
+	  free (opaque);
+	  return ret;
+	}
+      return save_webp (filename, data, width, height, config);
+#else
+      return save_imlib (filename, "webp", config->nail_quality);
+#endif
+    case NAIL_FORMAT_AVIF:
+#ifdef HAVE_LIBAVIF
+      return save_avif (filename, data, width, height,
+			imlib_image_has_alpha (), config);
+#else
+      return save_imlib (filename, "avif", config->nail_quality);
+#endif
+    default:
+      return save_imlib (filename, NULL, config->nail_quality);
+    }
+}
@@ -28,6 +28,7 @@
 #include <libexif/exif-content.h>
 #include <libexif/exif-entry.h>
 #include <libexif/exif-tag.h>
+#include <libexif/exif-utils.h>
 
 #include "main.h"
 
@@ -238,14 +239,13 @@ callback_exif_content (ExifContent *ec, void *user_data)
 void
 load_exif_data (image_l *img)
 {
-  char *filename;
+  path_t *filename = path_get ();
   ExifData *ed;
   int i;
 
-  if (asprintf (&filename, "%s/%s", img->srcdir, img->name) < 0)
-    yapa_oom ();
-  ed = exif_data_new_from_file (filename);
-  free (filename);
+  path_set (filename, img->srcdir);
+  ed = exif_data_new_from_file (path_add (filename, img->name));
+  path_put (filename);
 
   if (ed == NULL)
     return;
@@ -371,3 +371,82 @@ load_exif_data (image_l *img)
 	break;
       }
 }
+
+/* The EXIF data is only needed for the html page of the image, free
+   it afterwards.  */
+void
+free_exif_data (image_l *img)
+{
+  int i;
+
+  for (i = 0; i < MAX_EXIF_LINES; i++)
+    {
+      free (img->exif_val[i]);
+      img->exif_val[i] = NULL;
+      img->exif_key[i] = NULL;
+    }
+  free (img->exif_google_url);
+  img->exif_google_url = NULL;
+  free (img->exif_osm_url);
+  img->exif_osm_url = NULL;
+  img->have_exif_data = 0;
+}
+
+/* The EXIF Orientation of an image, 1 if it has none.  */
+static int
+get_orientation (ExifData *ed)
+{
+  ExifEntry *ee = exif_data_get_entry (ed, EXIF_TAG_ORIENTATION);
+  int orientation;
+
+  if (ee == NULL || ee->format != EXIF_FORMAT_SHORT || ee->components < 1)
+    return 1;
+  orientation = exif_get_short (ee->data, exif_data_get_byte_order (ed));
+
+  return orientation >= 1 && orientation <= 8 ? orientation : 1;
+}
+
+/* Return the EXIF Orientation of an image file, 1 if it has none.  */
+int
+load_exif_orientation (const char *filename)
+{
+  ExifData *ed;
+  int orientation;
+
+  ed = exif_data_new_from_file (filename);
+  if (ed == NULL)
+    return 1;
+  orientation = get_orientation (ed);
+  exif_data_free (ed);
+
+  return orientation;
+}
+
+/* Return a copy of the thumbnail embedded in the EXIF data of an
+   image file, or NULL if there is none. The thumbnail is stored in
+   the orientation of the image, which is returned, too.  */
+unsigned char *
+load_exif_thumbnail (const char *filename, unsigned int *size,
+		     int *orientation)
+{
+  unsigned char *data = NULL;
+  ExifData *ed;
+
+  *orientation = 1;
+  ed = exif_data_new_from_file (filename);
+  if (ed == NULL)
+    return NULL;
+
+  *orientation = get_orientation (ed);
+  if (ed->data != NULL && ed->size > 0)
+    {
+      data = malloc (ed->size);
+      if (data == NULL)
+	yapa_oom ();
+      memcpy (data, ed->data, ed->size);
+      *size = ed->size;
+    }
+  exif_data_free (ed);
+
+  return data;
+}
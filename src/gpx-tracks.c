@@ -29,53 +29,24 @@
 #include "main.h"
 
 
+/* path is not copied, it has to live as long as the entry, see
+   scan_dir.  */
 gpx_l *
-add_gpx (gpx_l **descr, const char *path,
+add_gpx (dir_l *dir, const char *path,
 	 const char *filename, time_t mtime)
 {
+  arena_t *arena = dir_arena (dir);
+  gpx_l *new = arena_alloc (arena, sizeof (gpx_l));
+
   if (debug_flag)
     printf ("ADD GPX Track: %s\n", path);
 
-  if (*descr == NULL)
-    {
-      *descr = calloc (1, sizeof (gpx_l));
-      if (filename != NULL)
-	(*descr)->name = strdup (filename);
-      (*descr)->path = strdup (path);
-      (*descr)->mtime = mtime;
-      return *descr;
-    }
-  else
-    {
-      gpx_l *ptr, *new = calloc (1, sizeof (gpx_l));
-
-      ptr = *descr;
-      while (ptr->next != NULL)
-	ptr = ptr->next;
-
-      ptr->next = new;
-      new->prev = ptr;
-      if (filename != NULL)
-	new->name = strdup (filename);
-      new->path = strdup (path);
-      new->mtime = mtime;
-      return new;
-    }
-}
-
-void
-free_gpx (gpx_l **ptr)
-{
-  if ((*ptr)->name)
-    free ((*ptr)->name);
-  if ((*ptr)->path)
-    free ((*ptr)->path);
-  if ((*ptr)->label)
-    free ((*ptr)->label);
-
-  if ((*ptr)->next != NULL)
-    free_gpx (&((*ptr)->next));
-  free (*ptr);
+  if (filename != NULL)
+    new->name = arena_strdup (arena, filename);
+  new->path = path;
+  new->mtime = mtime;
+  list_append (&dir->gpx, new);
+  return new;
 }
 
 #if 0
@@ -154,139 +125,6 @@ get_and_delete_dir_entry (dir_l **dirs, const char *name)
 }
 #endif
 
-static gpx_l *
-get_and_delete_gpx_entry (gpx_l **gpx, const char *name)
-{
-  gpx_l *ptr = *gpx;
-
-  while (ptr != NULL)
-    {
-      if (strcmp (ptr->name, name) == 0)
-	{
-	  gpx_l *ret = ptr;
-
-	  if (ptr->prev == NULL) /* first gpx file */
-	    {
-	      *gpx = (*gpx)->next;
-	      if (*gpx != NULL)
-		(*gpx)->prev = NULL;
-	      return ret;
-	    }
-	  else /* previous gpx file points to next gpx */
-	    ptr->prev->next = ptr->next;
-
-	  if (ptr->next == NULL) /* last image */
-	    {
-	      ptr = ptr->prev;
-	      if (ptr != NULL)
-		ptr->next = NULL;
-	      return ret;
-	    }
-	  else /* next gpx points to previous one */
-	    ptr->next->prev = ptr->prev;
-
-	  return ret;
-	}
-      ptr = ptr->next;
-    }
-  return NULL;
-}
-
-static gpx_l *
-sort_gpx_list (gpx_l *gpx)
-{
-  gpx_l *new = gpx;
-
-  if (debug_flag)
-    {
-      printf ("=> Sort GPX Files\n");
-      gpx_l *dbg = gpx;
-      while (dbg != NULL)
-	{
-	  printf ("==> %s\n", dbg->name);
-	  dbg = dbg->next;
-	}
-    }
-
-  gpx = gpx->next;
-  new->prev = NULL;
-  new->next = NULL;
-
-  while (gpx != NULL)
-    {
-      gpx_l *tmp = new;
-
-      while (tmp != NULL)
-	{
-	  int cmp = strcmp (tmp->name, gpx->name);
-
-	  /* gpx->name should come before tmp->name */
-	  if (cmp >= 0)
-	    {
-	      if (tmp->prev == NULL)
-		{
-		  new = gpx;
-		  gpx = gpx->next;
-		  new->prev = NULL;
-		  new->next = tmp;
-		  tmp->prev = new;
-		}
-	      else
-		{
-		  gpx_l *next = gpx->next;
-
-		  tmp->prev->next = gpx;
-		  gpx->prev = tmp->prev;
-		  tmp->prev = gpx;
-		  gpx->next = tmp;
-		  gpx = next;
-		}
-	      break;
-	    }
-	  /* gpx->name should come after tmp->name */
-	  else /* if (cmp < 0) */
-	    {
-	      if (tmp->next == NULL)
-		{
-		  gpx_l *next = gpx->next;
-
-		  tmp->next = gpx;
-		  tmp->next->prev = tmp;
-		  tmp->next->next = NULL;
-		  gpx = next;
-		  break;
-		}
-	      else
-		tmp = tmp->next;
-	    }
-	}
-
-      /* gpx = gpx->next; */
-    }
-
-  if (debug_flag)
-    {
-      printf ("=> Result\n");
-      gpx_l *dbg = new;
-      gpx_l *back = NULL;
-
-      while (dbg != NULL)
-	{
-	  printf ("==> %s\n", dbg->name);
-	  if (dbg->next == NULL)
-	    back = dbg;
-	  dbg = dbg->next;
-	}
-      while (back != NULL)
-	{
-	  printf ("==> %s\n", back->name);
-	  back = back->prev;
-	}
-    }
-
-  return new;
-}
-
 void
 sort_gpx (dir_l *dir)
 {
@@ -309,7 +147,7 @@ sort_gpx (dir_l *dir)
   if (debug_flag)
     printf ("SORT_GPX(%s)\n", filename);
 
-  if (dir->gpx == NULL)
+  if (dir->gpx.first == NULL)
     {
       unlink (filename); /* delete old crap */
       free (filename);
@@ -317,14 +155,16 @@ sort_gpx (dir_l *dir)
     }
 
   /* open old file with order and labels */
+  count_syscall (SYS_OPEN);
   FILE *fp = fopen (filename, "r");
   if (fp != NULL)
     {
-      gpx_l *newlist = NULL, *curr_new = NULL;
+      list_t newlist = LIST_INIT;
       char *buf = NULL;
       size_t buflen = 0;
       struct stat st;
 
+      count_syscall (SYS_STAT);
       stat (filename, &st);
       gpx_mtime = st.st_mtime;
 
@@ -353,7 +193,7 @@ sort_gpx (dir_l *dir)
 	  if (ptr != NULL)
 	    *ptr++='\0';
 
-	  gpx_l *gpx = get_and_delete_gpx_entry (&dir->gpx, cp);
+	  gpx_l *gpx = list_remove (&dir->gpx, cp);
 	  if (gpx == NULL)
 	    {
 	      if (debug_flag)
@@ -364,46 +204,23 @@ sort_gpx (dir_l *dir)
 	  else
 	    {
 	      if (ptr)
-		gpx->label = strdup (ptr);
-	      if (newlist == NULL)
-		{
-		  newlist = gpx;
-		  curr_new = gpx;
-		  newlist->prev = NULL;
-		  newlist->next = NULL;
-		}
-	      else
-		{
-		  curr_new->next = gpx;
-		  gpx->prev = curr_new;
-		  gpx->next = NULL;
-		  curr_new = gpx;
-		}
+		gpx->label = arena_strdup (dir_arena (dir), ptr);
+	      list_append (&newlist, gpx);
 	    }
 	}
-      if (dir->gpx != NULL)
+      if (dir->gpx.first != NULL)
 	{
 	  if (debug_flag)
 	    printf ("FOUND NEW GPX Tracks\n");
 
 	  if (dir->config.sort_img == 1) /* Add sorted gpx files at the
 					    end of existing list */
-	    dir->gpx = sort_gpx_list(dir->gpx);
+	    list_sort (&dir->gpx, dir->config.sort_img_natural);
 
-	  if (newlist)
-	    {
-	      curr_new->next = dir->gpx;
-	      dir->gpx->prev = curr_new;
-	    }
-	  else
-	    {
-	      newlist = dir->gpx;
-	      curr_new = dir->gpx;
-	      curr_new->prev = NULL;
-	    }
 	  dir->force_html = 1;
 	  need_to_save = 1;
 	}
+      list_concat (&newlist, &dir->gpx);
       dir->gpx = newlist;
       free (buf);
       fclose (fp);
@@ -413,20 +230,20 @@ sort_gpx (dir_l *dir)
       need_to_save = 1;
       if (dir->config.sort_img == 1) /* Add sorted gpx tracks at the
 					end of existing list */
-	dir->gpx = sort_gpx_list (dir->gpx);
+	list_sort (&dir->gpx, dir->config.sort_img_natural);
     }
 
   /* Save new file with order and labels */
-  if (dir->gpx != NULL && need_to_save)
+  if (dir->gpx.first != NULL && need_to_save)
     {
       /* sort all gpx files */
       if (dir->config.sort_img == 2)
-	dir->gpx = sort_gpx_list (dir->gpx);
+	list_sort (&dir->gpx, dir->config.sort_img_natural);
 
       fp = fopen (filename, "w");
       if (fp == NULL)
 	abort ();
-      gpx_l *ptr = dir->gpx;
+      gpx_l *ptr = dir->gpx.first;
       while (ptr)
 	{
 	  fprintf (fp, "%s", ptr->name);
@@ -442,7 +259,7 @@ sort_gpx (dir_l *dir)
 
   /* Go through all html files, look if we need to create or delete
      some of them. */
-  gpx_l *ptr = dir->gpx;
+  gpx_l *ptr = dir->gpx.first;
   while (ptr != NULL)
     {
       txt_l *html = get_and_delete_html_entry (&dir->html, ptr->name);
@@ -455,39 +272,33 @@ sort_gpx (dir_l *dir)
       else
 	{
 	  ptr->mtime = html->mtime;
-	  free (html->name);
-	  free (html->path);
-	  free (html);
 	  if (gpx_mtime > ptr->mtime)
 	    dir->force_html = 1; /* image file is changed */
 	}
       ptr = ptr->next;
     }
 
-  if (dir->html != NULL)
+  if (dir->html.first != NULL)
     {
+      txt_l *html;
+
       if (debug_flag)
 	printf ("===> OBSOLETE HTML FILES -> Recreate all html files\n");
       dir->force_html = 1; /* delete images, -> recreate everything */
 
-      while (dir->html != NULL)
+      for (html = dir->html.first; html != NULL; html = html->next)
 	{
-	  txt_l *tmp;
 	  char *fname;
 
-	  if (asprintf (&fname, "%s/%s", dir->html->path, dir->html->name) < 0)
+	  if (asprintf (&fname, "%s/%s", html->path, html->name) < 0)
 	    yapa_oom ();
 	  if (debug_flag)
-	    printf ("===> OBSOLETE HTML FILE %s\n", dir->html->name);
+	    printf ("===> OBSOLETE HTML FILE %s\n", html->name);
 	  else
-	    printf ("Delete obsolete html file %s\n", dir->html->name);
+	    printf ("Delete obsolete html file %s\n", html->name);
 	  unlink (fname); /* Delete old html file */
 	  free (fname);
-	  tmp = dir->html;
-	  dir->html = dir->html->next;
-	  free (tmp->path);
-	  free (tmp->name);
-	  free (tmp);
 	}
+      list_clear (&dir->html);
     }
 }
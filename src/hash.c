@@ -0,0 +1,215 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+
+/* Hash table with string keys and chaining. The keys are copied,
+   the values belong to the caller. Not thread safe. The entries
+   are allocated from an arena of the table, the memory of removed
+   ones is only released with the table.  */
+
+struct hash_entry_t {
+  struct hash_entry_t *next;
+  void *value;
+  char key[];
+};
+
+/* FNV-1a */
+static size_t
+hash_string (const char *key)
+{
+  size_t hash = 2166136261u;
+
+  while (*key)
+    {
+      hash ^= (unsigned char) *key++;
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+hash_table_t *
+hash_create (size_t size)
+{
+  hash_table_t *table = malloc (sizeof (hash_table_t));
+
+  if (table == NULL)
+    yapa_oom ();
+  if (size < 16)
+    size = 16;
+  table->size = size;
+  table->count = 0;
+  table->arena = arena_create ();
+  table->buckets = calloc (size, sizeof (hash_entry_t *));
+  if (table->buckets == NULL)
+    yapa_oom ();
+
+  return table;
+}
+
+static void
+hash_resize (hash_table_t *table)
+{
+  size_t i, size = table->size * 2;
+  hash_entry_t **buckets = calloc (size, sizeof (hash_entry_t *));
+
+  if (buckets == NULL)
+    yapa_oom ();
+
+  for (i = 0; i < table->size; i++)
+    {
+      hash_entry_t *entry = table->buckets[i];
+
+      while (entry != NULL)
+	{
+	  hash_entry_t *next = entry->next;
+	  size_t idx = hash_string (entry->key) % size;
+
+	  entry->next = buckets[idx];
+	  buckets[idx] = entry;
+	  entry = next;
+	}
+    }
+
+  free (table->buckets);
+  table->buckets = buckets;
+  table->size = size;
+}
+
+void *
+hash_lookup (const hash_table_t *table, const char *key)
+{
+  hash_entry_t *entry = table->buckets[hash_string (key) % table->size];
+
+  for (; entry != NULL; entry = entry->next)
+    if (strcmp (entry->key, key) == 0)
+      return entry->value;
+
+  return NULL;
+}
+
+/* Returns the entry of key, a new one without value if there is
+   none.  */
+static hash_entry_t *
+get_entry (hash_table_t *table, const char *key)
+{
+  size_t idx = hash_string (key) % table->size;
+  hash_entry_t *entry;
+
+  for (entry = table->buckets[idx]; entry != NULL; entry = entry->next)
+    if (strcmp (entry->key, key) == 0)
+      return entry;
+
+  if (table->count >= table->size)
+    {
+      hash_resize (table);
+      idx = hash_string (key) % table->size;
+    }
+
+  entry = arena_alloc (table->arena, sizeof (hash_entry_t) + strlen (key) + 1);
+  strcpy (entry->key, key);
+  entry->next = table->buckets[idx];
+  table->buckets[idx] = entry;
+  table->count++;
+
+  return entry;
+}
+
+/* Add or replace the value of key, returns the old value or NULL.  */
+void *
+hash_insert (hash_table_t *table, const char *key, void *value)
+{
+  hash_entry_t *entry = get_entry (table, key);
+  void *old = entry->value;
+
+  entry->value = value;
+  return old;
+}
+
+/* Returns the copy of key kept by the table, it is added if
+   needed. The copy stays valid until the table is freed.  */
+const char *
+hash_intern (hash_table_t *table, const char *key)
+{
+  return get_entry (table, key)->key;
+}
+
+/* Remove key from the table, returns its value or NULL.  */
+void *
+hash_remove (hash_table_t *table, const char *key)
+{
+  hash_entry_t **ptr = &table->buckets[hash_string (key) % table->size];
+
+  for (; *ptr != NULL; ptr = &(*ptr)->next)
+    if (strcmp ((*ptr)->key, key) == 0)
+      {
+	hash_entry_t *entry = *ptr;
+	void *value = entry->value;
+
+	*ptr = entry->next;
+	table->count--;
+	return value;
+      }
+
+  return NULL;
+}
+
+void
+hash_foreach (const hash_table_t *table,
+	      void (*func) (const char *key, void *value, void *data),
+	      void *data)
+{
+  size_t i;
+
+  for (i = 0; i < table->size; i++)
+    {
+      hash_entry_t *entry;
+
+      for (entry = table->buckets[i]; entry != NULL; entry = entry->next)
+	func (entry->key, entry->value, data);
+    }
+}
+
+/* Free the table, free_value is called for every value if not NULL. */
+void
+hash_free (hash_table_t *table, void (*free_value) (void *value))
+{
+  size_t i;
+
+  if (table == NULL)
+    return;
+
+  if (free_value)
+    for (i = 0; i < table->size; i++)
+      {
+	hash_entry_t *entry;
+
+	for (entry = table->buckets[i]; entry != NULL; entry = entry->next)
+	  free_value (entry->value);
+      }
+  arena_free (table->arena);
+  free (table->buckets);
+  free (table);
+}
@@ -24,104 +24,46 @@
 
 #include "main.h"
 
+/* path is not copied, it has to live as long as the entry, see
+   scan_dir.  */
 txt_l *
-add_html (txt_l **html, const char *path,
+add_html (dir_l *dir, const char *path,
 	 const char *filename, time_t mtime)
 {
+  arena_t *arena = dir_arena (dir);
+  txt_l *new = arena_alloc (arena, sizeof (txt_l));
+
   if (debug_flag)
     printf ("ADD HTML: %s\n", path);
 
-  if (*html == NULL)
-    {
-      *html = calloc (1, sizeof (txt_l));
-      if (filename != NULL)
-	(*html)->name = strdup (filename);
-      (*html)->path = strdup (path);
-      (*html)->mtime = mtime;
-      return *html;
-    }
-  else
-    {
-      txt_l *ptr, *new = calloc (1, sizeof (txt_l));
-
-      ptr = *html;
-      while (ptr->next != NULL)
-	ptr = ptr->next;
-
-      ptr->next = new;
-      new->prev = ptr;
-      if (filename != NULL)
-	new->name = strdup (filename);
-      new->path = strdup (path);
-      new->mtime = mtime;
-      return new;
-    }
+  if (filename != NULL)
+    new->name = arena_strdup (arena, filename);
+  new->path = path;
+  new->mtime = mtime;
+  list_append (&dir->html, new);
+  return new;
 }
 
 txt_l *
-get_html_entry (txt_l *html, const char *name)
+get_html_entry (list_t *html, const char *name)
 {
-  txt_l *ptr = html;
-  char *fullname;
-
-  if (asprintf (&fullname, "%s.html", name) < 0)
-    yapa_oom ();
+  path_t *htmlname = path_get ();
+  txt_l *ptr;
 
-  while (ptr)
-    {
-      if (strcmp (ptr->name, fullname) == 0)
-	{
-	  free (fullname);
-	  return ptr;
-	}
-      ptr = ptr->next;
-    }
-  free (fullname);
-  return NULL;
+  path_set (htmlname, name);
+  ptr = list_lookup (html, path_append (htmlname, ".html"));
+  path_put (htmlname);
+  return ptr;
 }
 
 txt_l *
-get_and_delete_html_entry (txt_l **html, const char *name)
+get_and_delete_html_entry (list_t *html, const char *name)
 {
-  txt_l *ptr = *html;
-  char *htmlname;
-
-  if (asprintf (&htmlname, "%s.html", name) < 0)
-    yapa_oom ();
-
-  while (ptr != NULL)
-    {
-      if (strcmp (ptr->name, htmlname) == 0)
-	{
-	  txt_l *ret = ptr;
-
-	  if (ptr->prev == NULL) /* first entry */
-	    {
-	      *html = (*html)->next;
-	      if (*html != NULL)
-		(*html)->prev = NULL;
-	      free (htmlname);
-	      return ret;
-	    }
-	  else /* previous entry points to next html file */
-	    ptr->prev->next = ptr->next;
-
-	  if (ptr->next == NULL) /* last entry */
-	    {
-	      ptr = ptr->prev;
-	      if (ptr != NULL)
-		ptr->next = NULL;
-	      free (htmlname);
-	      return ret;
-	    }
-	  else /* next dir points to previous one */
-	    ptr->next->prev = ptr->prev;
+  path_t *htmlname = path_get ();
+  txt_l *ptr;
 
-	  free (htmlname);
-	  return ret;
-	}
-      ptr = ptr->next;
-    }
-  free (htmlname);
-  return NULL;
+  path_set (htmlname, name);
+  ptr = list_remove (html, path_append (htmlname, ".html"));
+  path_put (htmlname);
+  return ptr;
 }
@@ -0,0 +1,251 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include "main.h"
+
+/* A .yapaignore file contains gitignore like patterns for files and
+   directories, which are not part of the album. It is valid for the
+   directory and all subdirectories, patterns of a deeper file
+   override the ones above. Supported are:
+     # comment
+     name or glob    matches the name in every directory below
+     dir/name        contains a slash: matches the path relative to
+                     the directory of the .yapaignore file
+     name/           matches only directories
+     !pattern        includes a file again, which was excluded
+     **              matches across directory levels
+   The patterns are compiled when the file is read, so that the check
+   of an entry needs no allocation in the common case.  */
+
+#define IGNORE_NEGATE   1  /* pattern starts with '!' */
+#define IGNORE_DIR_ONLY 2  /* pattern ends with '/' */
+#define IGNORE_PATH     4  /* match against the relative path */
+#define IGNORE_LITERAL  8  /* no glob characters, use strcmp */
+#define IGNORE_ANYDIR  16  /* contains **, '*' matches '/', too */
+
+struct ignore_pattern_t {
+  char *pattern;
+  int flags;
+};
+
+static void
+add_pattern (ignore_t *ignore, char *line)
+{
+  ignore_pattern_t *p;
+  size_t len;
+  int flags = 0;
+
+  if (*line == '!')
+    {
+      flags |= IGNORE_NEGATE;
+      line++;
+    }
+  len = strlen (line);
+  if (len > 0 && line[len - 1] == '/')
+    {
+      flags |= IGNORE_DIR_ONLY;
+      line[--len] = '\0';
+    }
+  if (strchr (line, '/') != NULL)
+    {
+      flags |= IGNORE_PATH;
+      /* "/name" means name relative to the directory */
+      if (*line == '/')
+	line++;
+    }
+  if (strpbrk (line, "*?[\\") == NULL)
+    flags |= IGNORE_LITERAL;
+  if (strstr (line, "**") != NULL)
+    {
+      flags |= IGNORE_ANYDIR;
+      /* a leading ** and slash before a name without further
+	 slashes is the same as only the name */
+      if (strncmp (line, "**/", 3) == 0 && strchr (&line[3], '/') == NULL)
+	{
+	  line += 3;
+	  flags &= ~(IGNORE_PATH | IGNORE_ANYDIR);
+	  if (strpbrk (line, "*?[\\") == NULL)
+	    flags |= IGNORE_LITERAL;
+	}
+    }
+  if (*line == '\0')
+    return;
+
+  /* grow the array whenever count reaches a power of two */
+  if ((ignore->count & (ignore->count - 1)) == 0)
+    {
+      size_t size = ignore->count ? ignore->count * 2 : 1;
+
+      ignore->patterns = realloc (ignore->patterns,
+				  size * sizeof (ignore_pattern_t));
+      if (ignore->patterns == NULL)
+	yapa_oom ();
+    }
+
+  p = &ignore->patterns[ignore->count++];
+  p->pattern = strdup (line);
+  if (p->pattern == NULL)
+    yapa_oom ();
+  p->flags = flags;
+}
+
+/* Read <directory>/.yapaignore, the patterns of parent stay valid.
+   Returns parent if the file contains no patterns.  */
+ignore_t *
+load_ignore_file (const char *directory, ignore_t *parent)
+{
+  ignore_t *ignore;
+  char *filename, *buf = NULL;
+  size_t buflen = 0;
+  FILE *fp;
+
+  if (asprintf (&filename, "%s/.yapaignore", directory) < 0)
+    yapa_oom ();
+  count_syscall (SYS_OPEN);
+  fp = fopen (filename, "r");
+  if (fp == NULL)
+    {
+      fprintf (stderr, _("WARNING: Cannot read %s: %m\n"), filename);
+      free (filename);
+      return parent;
+    }
+  free (filename);
+
+  ignore = calloc (1, sizeof (ignore_t));
+  if (ignore == NULL)
+    yapa_oom ();
+  ignore->directory = strdup (directory);
+  if (ignore->directory == NULL)
+    yapa_oom ();
+  ignore->len = strlen (directory);
+  ignore->parent = parent;
+
+  while (1)
+    {
+      ssize_t n = getline (&buf, &buflen, fp);
+
+      if (n < 1)
+	break;
+      /* remove trailing newline and spaces */
+      while (n > 0 && isspace ((int)buf[n - 1]))
+	buf[--n] = '\0';
+      if (n == 0 || buf[0] == '#')
+	continue;
+
+      add_pattern (ignore, buf);
+    }
+
+  free (buf);
+  fclose (fp);
+
+  if (ignore->count == 0)
+    {
+      free_ignore (ignore);
+      return parent;
+    }
+
+  if (debug_flag)
+    printf ("IGNORE: %zu patterns from %s/.yapaignore\n", ignore->count,
+	    directory);
+
+  return ignore;
+}
+
+static int
+match_pattern (const ignore_pattern_t *p, const char *name,
+	       const char *path)
+{
+  if (p->flags & IGNORE_PATH)
+    {
+      if (p->flags & IGNORE_LITERAL)
+	return strcmp (p->pattern, path) == 0;
+      return fnmatch (p->pattern, path,
+		      (p->flags & IGNORE_ANYDIR) ? 0 : FNM_PATHNAME) == 0;
+    }
+
+  if (p->flags & IGNORE_LITERAL)
+    return strcmp (p->pattern, name) == 0;
+  return fnmatch (p->pattern, name, 0) == 0;
+}
+
+/* Returns 1 if the entry name of directory should not be part of the
+   album. The last matching pattern of the deepest .yapaignore file
+   decides.  */
+int
+is_ignored (const ignore_t *ignore, const char *directory, const char *name,
+	    int is_dir)
+{
+  for (; ignore != NULL; ignore = ignore->parent)
+    {
+      char *path = NULL;
+      size_t i;
+
+      for (i = ignore->count; i-- > 0;)
+	{
+	  const ignore_pattern_t *p = &ignore->patterns[i];
+
+	  if ((p->flags & IGNORE_DIR_ONLY) && !is_dir)
+	    continue;
+
+	  if ((p->flags & IGNORE_PATH) && path == NULL)
+	    {
+	      /* path of the entry relative to the .yapaignore file */
+	      const char *rel = &directory[ignore->len];
+
+	      if (*rel == '/')
+		rel++;
+	      if (*rel == '\0')
+		path = strdup (name);
+	      else if (asprintf (&path, "%s/%s", rel, name) < 0)
+		path = NULL;
+	      if (path == NULL)
+		yapa_oom ();
+	    }
+
+	  if (match_pattern (p, name, path))
+	    {
+	      free (path);
+	      return !(p->flags & IGNORE_NEGATE);
+	    }
+	}
+      free (path);
+    }
+
+  return 0;
+}
+
+/* Free the patterns of one .yapaignore file, not of the parents.  */
+void
+free_ignore (ignore_t *ignore)
+{
+  size_t i;
+
+  for (i = 0; i < ignore->count; i++)
+    free (ignore->patterns[i].pattern);
+  free (ignore->patterns);
+  free (ignore->directory);
+  free (ignore);
+}
@@ -19,381 +19,684 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 #define X_DISPLAY_MISSING
 #include <Imlib2.h>
 
 #include "main.h"
 
-void
-create_nail (const char *srcdir, const char *dstdir, const char *fname,
-	     int size, const char *nailname)
+/* Save the current imlib2 image as nail NAILNAME of FNAME. The nail
+   is written to a temporary file, which replaces the old nail: that
+   one could be a hardlink to the image, see copy_file, and writing
+   into it would overwrite the image. The temporary file starts with
+   ".new.", so it is not taken as nail, and keeps the extension. If the
+   job gets killed, go_through_nails removes it.  */
+static int
+save_nail (const char *dstdir, const char *nailname, const char *fname,
+	   const config_t *config)
 {
-  Imlib_Image orig_image;
-  Imlib_Load_Error error;
-  char *filename;
+  path_t *filename = path_get (), *tmpname = path_get ();
+  path_t *nailbuf = path_get ();
+  const char *nailfile = get_nail_filename (nailbuf, fname, config);
+  int ret;
+
+  path_set (filename, dstdir);
+  path_add (filename, "yapa");
+  path_add (filename, nailname);
+  path_set (tmpname, filename->str);
+  path_add (tmpname, ".new.");
+  path_append (tmpname, nailfile);
+
+  ret = encode_nail (tmpname->str, fname, config);
+  if (ret != 0 && errno == ENOENT)
+    {
+      mkdir (filename->str, 0755);
+      ret = encode_nail (tmpname->str, fname, config);
+    }
+  path_add (filename, nailfile);
+  if (ret == 0 && rename (tmpname->str, filename->str) != 0)
+    ret = -1;
+  if (ret != 0)
+    {
+      fprintf (stderr, _("ERROR: Couldn't create nail %s: %m\n"),
+	       filename->str);
+      unlink (tmpname->str);
+    }
 
-  if (asprintf (&filename, "%s/%s", srcdir, fname) < 0)
-    yapa_oom ();
-  if (debug_flag)
-    printf ("========>CREATE: %s from %s\n", nailname, filename);
-  else
-    printf ("Create %s (max. %dx%d) for %s\n", nailname, size, size, fname);
+  path_put (nailbuf);
+  path_put (tmpname);
+  path_put (filename);
+  return ret;
+}
 
-  orig_image = imlib_load_image_with_error_return (filename, &error);
-  if (orig_image == NULL)
+/* Remove the nails of an image, used if creating them failed, so
+   that no half written or outdated nails are left.  */
+void
+remove_nails (const char *dstdir, const char *fname,
+	      const nail_t *nails, int count, const config_t *config)
+{
+  path_t *filename = path_get (), *nailbuf = path_get ();
+  const char *nailfile = get_nail_filename (nailbuf, fname, config);
+  size_t len;
+  int i;
+
+  path_set (filename, dstdir);
+  path_add (filename, "yapa");
+  len = filename->len;
+  for (i = 0; i < count; i++)
     {
-      fprintf (stderr,
-	       _("ERROR: Couldn't load image %s, imlib2 error code %d\n"),
-	       filename, error);
-      free (filename);
-      return;
+      path_truncate (filename, len);
+      path_add (filename, nails[i].nailname);
+      unlink (path_add (filename, nailfile));
     }
-  else
+  path_put (nailbuf);
+  path_put (filename);
+}
+
+#ifdef HAVE_LIBJPEG
+static int
+is_jpeg (const char *fname)
+{
+  const char *cp = strrchr (fname, '.');
+
+  return cp != NULL &&
+    (strcasecmp (cp, ".jpg") == 0 || strcasecmp (cp, ".jpeg") == 0);
+}
+#endif
+
+/* Sort nails by size, biggest first.  */
+static int
+compare_nails (const void *p1, const void *p2)
+{
+  const nail_t *n1 = p1;
+  const nail_t *n2 = p2;
+
+  return n2->size - n1->size;
+}
+
+/* Calculate the size of a nail with max. size pixels for an image
+   of width x height pixels. Returns 0 if the image is not bigger
+   than the nail and should not be scaled.  */
+int
+get_nail_size (unsigned int width, unsigned int height, int size,
+	       unsigned int *new_width, unsigned int *new_height)
+{
+  double max_size = size;
+  double actual_size = height > width ? height : width;
+  double scale_factor = max_size / actual_size;
+
+  if (scale_factor >= 1.0)
     {
-      Imlib_Image nail_image;
+      *new_width = width;
+      *new_height = height;
+      return 0;
+    }
 
-      imlib_context_set_image (orig_image);
+  *new_width = (unsigned int)(width * scale_factor);
+  *new_height = (unsigned int)(height * scale_factor);
+  if (*new_width == 0)
+    *new_width = 1;
+  if (*new_height == 0)
+    *new_height = 1;
 
-      unsigned int new_width = 0;
-      unsigned int new_height = 0;
-      unsigned int width = imlib_image_get_width ();
-      unsigned int height = imlib_image_get_height ();
-      double max_size = size;
-      double actual_size = height > width ? height : width;
-      double scale_factor = max_size / actual_size;
+  return 1;
+}
 
-      if (scale_factor < 1.0)
-	{
-	  new_width  = (unsigned int)(width * scale_factor);
-	  new_height = (unsigned int)(height * scale_factor);
+/* Estimate the memory create_nails needs for an image: the decoded
+   image and the biggest nail are both held twice, once by the
+   decoder or resampler and once as copy by imlib2.  */
+unsigned long long
+estimate_nail_memory (const char *srcdir, const char *fname,
+		      const nail_t *nails, int count)
+{
+  unsigned int width, height, nail_width, nail_height;
+  unsigned long long decoded;
+  path_t *filename = path_get ();
+  int i, max_size = 0;
 
+  for (i = 0; i < count; i++)
+    if (nails[i].size > max_size)
+      max_size = nails[i].size;
 
-	  nail_image =
-	    imlib_create_cropped_scaled_image (0, 0,
-					       width, height,
-					       new_width,
-					       new_height);
-	  imlib_free_image();
-	  imlib_context_set_image(nail_image);
-	}
-      free (filename);
+  path_set (filename, srcdir);
+  path_add (filename, fname);
 
-      if (asprintf (&filename, "%s/yapa/%s/%s",
-		    dstdir, nailname, fname) < 0)
-	yapa_oom ();
+  if (get_image_dimensions (filename->str, &width, &height) != 0)
+    {
+      struct stat st;
+
+      /* unknown format, assume an uncompressed image */
+      count_syscall (SYS_STAT);
+      if (stat (filename->str, &st) != 0)
+	st.st_size = 0;
+      path_put (filename);
+      return (unsigned long long) st.st_size * 2;
+    }
+  path_put (filename);
+
+  decoded = (unsigned long long) width * height;
+#ifdef HAVE_LIBJPEG
+  if (is_jpeg (fname))
+    {
+      /* libjpeg scales down while decoding, see jpeg_select_scale */
+      unsigned long long scaled_width, scaled_height;
+      unsigned int num;
 
-      imlib_save_image_with_error_return (filename, &error);
-      if (error != IMLIB_LOAD_ERROR_NONE)
+      for (num = 1; num < 8; num++)
 	{
-	  if (error == IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT)
+	  scaled_width = ((unsigned long long) width * num + 7) / 8;
+	  scaled_height = ((unsigned long long) height * num + 7) / 8;
+	  if ((scaled_width > scaled_height ? scaled_width : scaled_height) >=
+	      (unsigned long long) max_size)
 	    {
-	      char *cp;
-	      if (asprintf (&cp, "%s/yapa/%s", dstdir, nailname) < 0)
-		yapa_oom ();
-	      mkdir (cp, 0755);
-	      free (cp);
-	      imlib_save_image_with_error_return (filename, &error);
-	    }
-	  if (error != IMLIB_LOAD_ERROR_NONE)
-	    {
-	      fprintf (stderr,
-		       _("ERROR: Couldn't create nail %s, imlib2 error code %d\n"),
-		       filename, error);
-	      abort ();
+	      decoded = scaled_width * scaled_height;
+	      break;
 	    }
 	}
-      imlib_free_image ();
-      free (filename);
     }
+#endif
+
+  get_nail_size (width, height, max_size, &nail_width, &nail_height);
+
+  return (decoded + (unsigned long long) nail_width * nail_height) *
+    2 * sizeof (uint32_t);
 }
 
-static void
-internal_add_image (image_l **image_list, const char *srcdir,
-		    const char *dstdir, const char *filename,
-		    time_t mtime, const char *dbgmsg)
+/* Scale the current imlib2 image down to every nail and save them.
+   The size of the nails is always calculated from the size of the
+   original image (width x height), so that the result does not
+   depend on the previous nail or from which image data we start.
+   The image is freed afterwards.  */
+static int
+scale_and_save_nails (unsigned int width, unsigned int height,
+		      const char *dstdir, const char *fname,
+		      nail_t *nails, int count, const config_t *config)
 {
-  if (debug_flag)
-    printf ("ADD %s: %s/%s\n", dbgmsg, srcdir, filename);
+  unsigned int curr_width = imlib_image_get_width ();
+  unsigned int curr_height = imlib_image_get_height ();
+  int i;
 
-  if (*image_list == NULL)
-    {
-      *image_list = calloc (1, sizeof (image_l));
-      (*image_list)->name = strdup (filename);
-      (*image_list)->srcdir = strdup (srcdir);
-      (*image_list)->dstdir = strdup (dstdir);
-      (*image_list)->mtime = mtime;
-      (*image_list)->prev = NULL;
-      (*image_list)->next = NULL;
-    }
-  else
+  for (i = 0; i < count; i++)
     {
-      image_l *ptr, *new = calloc (1, sizeof (image_l));
-
-      ptr = *image_list;
-      while (ptr->next != NULL)
-	ptr = ptr->next;
-
-      ptr->next = new;
-      new->prev = ptr;
-      new->next = NULL;
-      new->name = strdup (filename);
-      new->srcdir = strdup (srcdir);
-      new->dstdir = strdup (dstdir);
-      new->mtime = mtime;
+      unsigned int new_width, new_height;
+
+      if (debug_flag)
+	printf ("========>CREATE: %s for %s\n", nails[i].nailname, fname);
+      else
+	printf ("Create %s (max. %dx%d) for %s\n", nails[i].nailname,
+		nails[i].size, nails[i].size, fname);
+
+      if (get_nail_size (width, height, nails[i].size,
+			 &new_width, &new_height) &&
+	  (new_width != curr_width || new_height != curr_height))
+	{
+	  char has_alpha = imlib_image_has_alpha ();
+	  uint32_t *data =
+	    resample_image (imlib_image_get_data_for_reading_only (),
+			    curr_width, curr_height,
+			    new_width, new_height,
+			    config->resample_filter);
+	  Imlib_Image nail_image =
+	    imlib_create_image_using_copied_data (new_width, new_height,
+						  (DATA32 *) data);
+	  free (data);
+	  imlib_free_image ();
+	  if (nail_image == NULL)
+	    return -1;
+	  imlib_context_set_image (nail_image);
+	  imlib_image_set_has_alpha (has_alpha);
+	  curr_width = new_width;
+	  curr_height = new_height;
+	}
+
+      if (save_nail (dstdir, nails[i].nailname, fname, config) != 0)
+	{
+	  imlib_free_image ();
+	  return -1;
+	}
     }
+  imlib_free_image ();
+  return 0;
 }
 
-void
-add_image (dir_l *dir, const char *srcdir, const char *dstdir,
-	   const char *filename, time_t mtime)
+#ifdef HAVE_LIBJPEG
+/* Create as many of the smallest nails as possible from the thumbnail
+   embedded in the EXIF data of a JPEG image. This is only done if the
+   thumbnail is big enough and has the same aspect ratio as the image,
+   many cameras add black borders to it. The EXIF orientation of the
+   image is returned in orientation. Returns the number of nails,
+   which still need to be created from the image itself, or -1 on
+   error.  */
+static int
+create_nails_from_exif (const char *filename, const char *dstdir,
+			const char *fname, nail_t *nails, int count,
+			const config_t *config, int *orientation)
 {
-  internal_add_image (&dir->images, srcdir, dstdir, filename, mtime, "IMAGE");
-}
+  unsigned int width, height, thumb_width, thumb_height, size;
+  unsigned long long diff;
+  unsigned char *exif_thumb;
+  Imlib_Image image;
+  uint32_t *data;
+  int first;
+
+  exif_thumb = load_exif_thumbnail (filename, &size, orientation);
+  if (exif_thumb == NULL)
+    return count;
+
+  if (get_jpeg_size (filename, &width, &height) != 0)
+    {
+      free (exif_thumb);
+      return count;
+    }
 
-void
-free_images (image_l **img)
-{
+  data = load_jpeg_mem (exif_thumb, size, &thumb_width, &thumb_height);
+  free (exif_thumb);
+  if (data == NULL)
+    return count;
 
-  if (*img == NULL)
-    return;
+  /* the thumbnail is stored unrotated like the image */
+  data = orient_image (data, &thumb_width, &thumb_height, *orientation);
+  if (*orientation >= 5)
+    {
+      unsigned int tmp = width;
 
-  if (debug_flag)
-    printf ("FREE IMAGE: %s\n", (*img)->name);
-
-  if ((*img)->name != NULL)
-    free ((*img)->name);
-  if ((*img)->srcdir != NULL)
-    free ((*img)->srcdir);
-  if ((*img)->dstdir != NULL)
-    free ((*img)->dstdir);
-  if ((*img)->label != NULL)
-    free ((*img)->label);
-  if ((*img)->exif_google_url != NULL)
-    free ((*img)->exif_google_url);
-  if ((*img)->exif_osm_url != NULL)
-    free ((*img)->exif_osm_url);
+      width = height;
+      height = tmp;
+    }
 
-  int i;
+  /* aspect ratio needs to match by 1% */
+  if ((unsigned long long) width * thumb_height >
+      (unsigned long long) height * thumb_width)
+    diff = (unsigned long long) width * thumb_height -
+      (unsigned long long) height * thumb_width;
+  else
+    diff = (unsigned long long) height * thumb_width -
+      (unsigned long long) width * thumb_height;
+  if (diff * 100 > (unsigned long long) width * thumb_height)
+    {
+      if (debug_flag)
+	printf ("========>EXIF: thumbnail %ux%u does not match %ux%u\n",
+		thumb_width, thumb_height, width, height);
+      free (data);
+      return count;
+    }
 
-  for (i = 0; i < MAX_EXIF_LINES; i++)
+  first = count;
+  while (first > 0)
     {
-      if ((*img)->exif_val[i] != NULL)
-	free ((*img)->exif_val[i]);
+      unsigned int new_width, new_height;
+
+      get_nail_size (width, height, nails[first - 1].size,
+		     &new_width, &new_height);
+      if (new_width > thumb_width || new_height > thumb_height)
+	break;
+      --first;
     }
 
-  if ((*img)->next != NULL)
-    free_images (&((*img)->next));
-  free (*img);
-}
+  if (first == count)
+    {
+      free (data);
+      return count;
+    }
 
-void
-add_midnail (image_l **nails, const char *path,
-	     const char *filename, time_t mtime)
-{
-  internal_add_image (nails, path, path, filename, mtime, "MIDNAIL");
+  if (debug_flag)
+    printf ("========>EXIF: using %ux%u thumbnail of %s\n",
+	    thumb_width, thumb_height, fname);
+
+  image = imlib_create_image_using_copied_data (thumb_width, thumb_height,
+						(DATA32 *) data);
+  free (data);
+  if (image == NULL)
+    return count;
+  imlib_context_set_image (image);
+  imlib_image_set_has_alpha (0);
+
+  if (scale_and_save_nails (width, height, dstdir, fname,
+			    &nails[first], count - first, config) != 0)
+    return -1;
+
+  return first;
 }
+#endif
 
-void
-add_thumbnail (image_l **nails, const char *path,
-	       const char *filename, time_t mtime)
+/* Copy the data of one file to another one.  */
+static int
+copy_data (int in, int out)
 {
-  internal_add_image (nails, path, path, filename, mtime, "THUMBNAIL");
+  char buf[65536];
+  ssize_t n;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while ((n = copy_file_range (in, NULL, out, NULL, 1 << 30, 0)) > 0)
+    ;
+  if (n == 0)
+    return 0;
+  if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+      errno != EOPNOTSUPP)
+    return -1;
+#endif
+
+  while ((n = read (in, buf, sizeof (buf))) > 0)
+    if (write (out, buf, n) != n)
+      return -1;
+
+  return n == 0 ? 0 : -1;
 }
 
-#if 0
-image_l *
-get_image_entry (image_l **image, const char *name)
+/* Copy a file without duplicating its data if possible: as reflink
+   if the filesystem supports it, else as hardlink. A nail must never
+   be written in place, see save_nail. Returns the method used or
+   NULL on error.  */
+static const char *
+copy_file (const char *srcfile, const char *dstfile)
 {
-  image_l *ptr = *image;
+  const char *method = NULL;
+  int in, out, err;
 
-  while (ptr != NULL)
+  unlink (dstfile);
+
+  in = open (srcfile, O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+    return NULL;
+
+  out = open (dstfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (out < 0)
     {
-      if (strcmp (ptr->name, name) == 0)
-	return ptr;
-      ptr = ptr->next;
+      err = errno;
+      close (in);
+      errno = err;
+      return NULL;
     }
-  return NULL;
-}
+
+#ifdef FICLONE
+  if (ioctl (out, FICLONE, in) == 0)
+    method = "reflink";
 #endif
 
+  if (method == NULL)
+    {
+      close (out);
+      unlink (dstfile);
+
+      if (link (srcfile, dstfile) == 0)
+	{
+	  close (in);
+	  return "hardlink";
+	}
 
-image_l *
-get_and_delete_image_entry (image_l **image, const char *name)
+      out = open (dstfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if (out < 0)
+	{
+	  err = errno;
+	  close (in);
+	  errno = err;
+	  return NULL;
+	}
+      if (copy_data (in, out) == 0)
+	method = "copy";
+    }
+
+  err = errno;
+  close (in);
+  if (close (out) != 0)
+    method = NULL;
+  if (method == NULL)
+    unlink (dstfile);
+  errno = err;
+
+  return method;
+}
+
+/* Nails, which are not smaller than the image and have the same
+   format, are copies of the image and get created without decoding
+   it. The nails array has to be sorted biggest first. Returns the
+   number of nails created this way or -1 on error.  */
+static int
+passthrough_nails (const char *filename, const char *dstdir,
+		   const char *fname, nail_t *nails, int count,
+		   const config_t *config)
 {
-  image_l *ptr = *image;
+  unsigned int width, height;
+  path_t *dstfile, *nailbuf = path_get ();
+  size_t len, dirlen;
+  int i;
 
-  while (ptr != NULL)
+  /* the nail has the name of the image, if it has the same format */
+  if (get_nail_filename (nailbuf, fname, config) != fname ||
+      get_image_dimensions (filename, &width, &height) != 0)
     {
-      if (strcmp (ptr->name, name) == 0)
-	{
-	  image_l *ret = ptr;
+      path_put (nailbuf);
+      return 0;
+    }
+  path_put (nailbuf);
 
-	  if (ptr->prev == NULL) /* first image */
-	    {
-	      *image = (*image)->next;
-	      if (*image != NULL)
-		(*image)->prev = NULL;
-	      return ret;
-	    }
-	  else /* previous images points to next image */
-	    ptr->prev->next = ptr->next;
+  dstfile = path_get ();
+  path_set (dstfile, dstdir);
+  path_add (dstfile, "yapa");
+  len = dstfile->len;
 
-	  if (ptr->next == NULL) /* last image */
-	    {
-	      ptr = ptr->prev;
-	      if (ptr != NULL)
-		ptr->next = NULL;
-	      return ret;
-	    }
-	  else /* next image points to previous one */
-	    ptr->next->prev = ptr->prev;
+  for (i = 0; i < count; i++)
+    {
+      const char *method;
+
+      if (width > (unsigned int) nails[i].size ||
+	  height > (unsigned int) nails[i].size)
+	break;
 
-	  return ret;
+      path_truncate (dstfile, len);
+      path_add (dstfile, nails[i].nailname);
+      dirlen = dstfile->len;
+      path_add (dstfile, fname);
+
+      method = copy_file (filename, dstfile->str);
+      if (method == NULL && errno == ENOENT)
+	{
+	  mkdir (path_truncate (dstfile, dirlen), 0755);
+	  method = copy_file (filename, path_add (dstfile, fname));
 	}
-      ptr = ptr->next;
+      if (method == NULL)
+	{
+	  fprintf (stderr, _("ERROR: Couldn't create nail %s: %m\n"),
+		   dstfile->str);
+	  path_put (dstfile);
+	  return -1;
+	}
+
+      if (debug_flag)
+	printf ("========>PASSTHROUGH: %s for %s (%s)\n", nails[i].nailname,
+		fname, method);
+      else
+	printf ("Copy %s (max. %dx%d) for %s\n", nails[i].nailname,
+		nails[i].size, nails[i].size, fname);
     }
-  return NULL;
+  path_put (dstfile);
+
+  return i;
 }
 
-static image_l *
-sort_img (image_l *img)
+/* Create all nails from one decode of the original image. The
+   biggest nail is scaled from the original, every smaller one
+   from the previous nail. The nails array gets sorted by size.
+   Returns 0 on success, -1 on error.  */
+int
+create_nails (const char *srcdir, const char *dstdir, const char *fname,
+	      nail_t *nails, int count, const config_t *config)
 {
-  image_l *new = img;
+  Imlib_Image image;
+  Imlib_Load_Error error;
+  path_t *path;
+  const char *filename;
+  unsigned int width, height;
+  int copied;
 
-  if (debug_flag)
+  if (count <= 0)
+    return 0;
+
+  path = path_get ();
+  path_set (path, srcdir);
+  filename = path_add (path, fname);
+
+  qsort (nails, count, sizeof (nail_t), compare_nails);
+
+  /* nails not smaller than the image don't need a decode */
+  copied = passthrough_nails (filename, dstdir, fname, nails, count, config);
+  if (copied < 0 || copied == count)
     {
-      printf ("=> Sort Images\n");
-      image_l *dbg = img;
-      while (dbg != NULL)
-	{
-	  printf ("==> %s\n", dbg->name);
-	  dbg = dbg->next;
-	}
+      path_put (path);
+      return copied < 0 ? -1 : 0;
     }
+  nails += copied;
+  count -= copied;
 
-  img = img->next;
-  new->prev = NULL;
-  new->next = NULL;
+  if (debug_flag)
+    printf ("========>LOAD: %s\n", filename);
 
-  while (img != NULL)
+  image = NULL;
+#ifdef HAVE_LIBJPEG
+  if (is_jpeg (fname))
     {
-      image_l *tmp = new;
+      unsigned int curr_width, curr_height;
+      int orientation = 0; /* not read yet */
+      uint32_t *data;
 
-      while (tmp != NULL)
+      if (config->exif_thumbnail)
 	{
-	  int cmp = strcmp (tmp->name, img->name);
+	  count = create_nails_from_exif (filename, dstdir, fname,
+					  nails, count, config,
+					  &orientation);
+	  if (count <= 0)
+	    {
+	      path_put (path);
+	      return count;
+	    }
+	}
 
-	  /* img->name should come before tmp->name */
-	  if (cmp >= 0)
+      /* Let libjpeg scale JPEG images down while decoding them,
+	 only the rest is done by resampling. */
+      data = load_jpeg_scaled (filename, nails[0].size,
+			       &curr_width, &curr_height, &width, &height);
+      if (data != NULL)
+	{
+	  if (orientation == 0)
+	    orientation = load_exif_orientation (filename);
+	  data = orient_image (data, &curr_width, &curr_height, orientation);
+	  if (orientation >= 5)
 	    {
-	      if (tmp->prev == NULL)
-		{
-		  new = img;
-		  img = img->next;
-		  new->prev = NULL;
-		  new->next = tmp;
-		  tmp->prev = new;
-		}
-	      else
-		{
-		  image_l *next = img->next;
-
-		  tmp->prev->next = img;
-		  img->prev = tmp->prev;
-		  tmp->prev = img;
-		  img->next = tmp;
-		  img = next;
-		}
-	      break;
+	      unsigned int tmp = width;
+
+	      width = height;
+	      height = tmp;
 	    }
-	  /* img->name should come after tmp->name */
-	  else /* if (cmp < 0) */
+	  image = imlib_create_image_using_copied_data (curr_width,
+							curr_height,
+							(DATA32 *) data);
+	  free (data);
+	  if (image != NULL)
 	    {
-	      if (tmp->next == NULL)
-		{
-		  image_l *next = img->next;
-
-		  tmp->next = img;
-		  tmp->next->prev = tmp;
-		  tmp->next->next = NULL;
-		  img = next;
-		  break;
-		}
-	      else
-		tmp = tmp->next;
+	      imlib_context_set_image (image);
+	      imlib_image_set_has_alpha (0);
 	    }
 	}
-
-      /* img = img->next; */
     }
+#endif
 
-  if (debug_flag)
+  if (image == NULL)
     {
-      printf ("=> Result\n");
-      image_l *dbg = new;
-      image_l *back = NULL;
-
-      while (dbg != NULL)
+      image = imlib_load_image_with_error_return (filename, &error);
+      if (image == NULL)
 	{
-	  printf ("==> %s\n", dbg->name);
-	  if (dbg->next == NULL)
-	    back = dbg;
-	  dbg = dbg->next;
-	}
-      while (back != NULL)
-	{
-	  printf ("==> %s\n", back->name);
-	  back = back->prev;
+	  fprintf (stderr,
+		   _("ERROR: Couldn't load image %s, imlib2 error code %d\n"),
+		   filename, error);
+	  path_put (path);
+	  return -1;
 	}
+      imlib_context_set_image (image);
+      width = imlib_image_get_width ();
+      height = imlib_image_get_height ();
     }
+  path_put (path);
+
+  return scale_and_save_nails (width, height, dstdir, fname, nails, count,
+			       config);
+}
+
+static void
+internal_add_image (arena_t *arena, list_t *image_list, const char *srcdir,
+		    const char *dstdir, const char *filename,
+		    time_t mtime, const char *dbgmsg)
+{
+  image_l *new = arena_alloc (arena, sizeof (image_l));
+
+  if (debug_flag)
+    printf ("ADD %s: %s/%s\n", dbgmsg, srcdir, filename);
 
-  return new;
+  new->name = arena_strdup (arena, filename);
+  new->srcdir = srcdir;
+  new->dstdir = dstdir;
+  new->mtime = mtime;
+  list_append (image_list, new);
 }
 
+/* srcdir and dstdir are not copied, they have to live as long as
+   the entry, see scan_dir.  */
+void
+add_image (dir_l *dir, const char *srcdir, const char *dstdir,
+	   const char *filename, time_t mtime)
+{
+  internal_add_image (dir_arena (dir), &dir->images, srcdir, dstdir,
+		      filename, mtime, "IMAGE");
+}
+
+void
+add_nail (arena_t *arena, list_t *nails, const char *path,
+	  const char *filename, time_t mtime)
+{
+  internal_add_image (arena, nails, path, path, filename, mtime, "NAIL");
+}
 
 void
 sort_images (dir_l *dir)
 {
-  char *filename;
+  path_t *path = path_get ();
+  const char *filename;
   int need_to_save = 0;
   time_t image_mtime = 0;
 
-  if (dir->name == NULL)
-    {
-      if (asprintf (&filename, "%s/yapa/images", dir->path) < 0)
-	yapa_oom ();
-    }
-  else
-    {
-      if (asprintf (&filename, "%s/%s/yapa/images",
-		    dir->path, dir->name) < 0)
-	yapa_oom ();
-    }
+  path_dir (path, dir);
+  filename = path_add (path, "yapa/images");
 
   if (debug_flag)
     printf ("SORT_IMAGES(%s)\n", filename);
 
-  if (dir->images == NULL)
+  if (dir->images.first == NULL)
     {
       unlink (filename); /* delete old crap */
-      free (filename);
+      path_put (path);
       return;
     }
 
   /* open old file with order and labels */
+  count_syscall (SYS_OPEN);
   FILE *fp = fopen (filename, "r");
   if (fp != NULL)
     {
-      image_l *newlist = NULL, *curr_new = NULL;
+      list_t newlist = LIST_INIT;
       char *buf = NULL;
       size_t buflen = 0;
       struct stat st;
 
+      count_syscall (SYS_STAT);
       stat (filename, &st);
       image_mtime = st.st_mtime;
 
@@ -422,7 +725,7 @@ sort_images (dir_l *dir)
 	  if (ptr != NULL)
 	    *ptr++='\0';
 
-	  image_l *img = get_and_delete_image_entry (&dir->images, cp);
+	  image_l *img = list_remove (&dir->images, cp);
 	  if (img == NULL)
 	    {
 	      if (debug_flag)
@@ -433,46 +736,23 @@ sort_images (dir_l *dir)
 	  else
 	    {
 	      if (ptr)
-		img->label = strdup (ptr);
-	      if (newlist == NULL)
-		{
-		  newlist = img;
-		  curr_new = img;
-		  newlist->prev = NULL;
-		  newlist->next = NULL;
-		}
-	      else
-		{
-		  curr_new->next = img;
-		  img->prev = curr_new;
-		  img->next = NULL;
-		  curr_new = img;
-		}
+		img->label = arena_strdup (dir_arena (dir), ptr);
+	      list_append (&newlist, img);
 	    }
 	}
-      if (dir->images != NULL)
+      if (dir->images.first != NULL)
 	{
 	  if (debug_flag)
 	    printf ("FOUND NEW IMAGES\n");
 
 	  if (dir->config.sort_img == 1) /* Add sorted images at the
 					    end of existing list */
-	    dir->images = sort_img (dir->images);
+	    list_sort (&dir->images, dir->config.sort_img_natural);
 
-	  if (newlist)
-	    {
-	      curr_new->next = dir->images;
-	      dir->images->prev = curr_new;
-	    }
-	  else
-	    {
-	      newlist = dir->images;
-	      curr_new = dir->images;
-	      curr_new->prev = NULL;
-	    }
 	  dir->force_html = 1;
 	  need_to_save = 1;
 	}
+      list_concat (&newlist, &dir->images);
       dir->images = newlist;
       free (buf);
       fclose (fp);
@@ -482,20 +762,20 @@ sort_images (dir_l *dir)
       need_to_save = 1;
       if (dir->config.sort_img == 1) /* Add sorted images at the
 					end of existing list */
-	dir->images = sort_img (dir->images);
+	list_sort (&dir->images, dir->config.sort_img_natural);
     }
 
   /* Save new file with order and labels */
-  if (dir->images != NULL && need_to_save)
+  if (dir->images.first != NULL && need_to_save)
     {
       /* sort all images */
       if (dir->config.sort_img == 2)
-	dir->images = sort_img (dir->images);
+	list_sort (&dir->images, dir->config.sort_img_natural);
 
       fp = fopen (filename, "w");
       if (fp == NULL)
 	abort ();
-      image_l *ptr = dir->images;
+      image_l *ptr = dir->images.first;
       while (ptr)
 	{
 	  fprintf (fp, "%s", ptr->name);
@@ -507,11 +787,11 @@ sort_images (dir_l *dir)
       fclose (fp);
     }
 
-  free (filename);
+  path_put (path);
 
   /* Go through all html files, look if we need to create or delete
      some of them. */
-  image_l *ptr = dir->images;
+  image_l *ptr = dir->images.first;
   while (ptr != NULL)
     {
       txt_l *html = get_and_delete_html_entry (&dir->html, ptr->name);
@@ -524,49 +804,41 @@ sort_images (dir_l *dir)
       else
 	{
 	  ptr->html_mtime = html->mtime;
-	  free (html->name);
-	  free (html->path);
-	  free (html);
 	  if (image_mtime > ptr->html_mtime)
 	    dir->force_html = 1; /* image file is changed */
 	}
       ptr = ptr->next;
     }
 
-  if (dir->html != NULL)
+  if (dir->html.first != NULL)
     {
+      txt_l *html;
+
       if (debug_flag)
 	printf ("===> OBSOLETE HTML FILES -> Recreate all html files\n");
       dir->force_html = 1; /* delete images, -> recreate everything */
 
-      while (dir->html != NULL)
+      path = path_get ();
+      for (html = dir->html.first; html != NULL; html = html->next)
 	{
-	  txt_l *tmp;
-	  char *fname;
-
-	  if (asprintf (&fname, "%s/%s", dir->html->path, dir->html->name) < 0)
-	    yapa_oom ();
 	  if (debug_flag)
-	    printf ("===> OBSOLETE HTML FILE %s\n", dir->html->name);
+	    printf ("===> OBSOLETE HTML FILE %s\n", html->name);
 	  else
-	    printf ("Delete obsolete html file %s\n", dir->html->name);
-	  unlink (fname); /* Delete old html file */
-	  free (fname);
-	  tmp = dir->html;
-	  dir->html = dir->html->next;
-	  free (tmp->path);
-	  free (tmp->name);
-	  free (tmp);
+	    printf ("Delete obsolete html file %s\n", html->name);
+	  path_set (path, html->path);
+	  unlink (path_add (path, html->name)); /* Delete old html file */
 	}
+      path_put (path);
+      list_clear (&dir->html);
     }
 
 
   /* Go through all txt files and look if we need to recreate html
      files. */
-  ptr = dir->images;
+  ptr = dir->images.first;
   while (ptr != NULL)
     {
-      txt_l *txt = get_txt_entry (dir->texts, ptr->name);
+      txt_l *txt = get_txt_entry (&dir->texts, ptr->name);
       if (txt == NULL)
 	{
 	  if (debug_flag)
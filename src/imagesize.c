@@ -0,0 +1,118 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+
+/* Read the dimensions of an image from its header without decoding
+   it. Only JPEG and PNG are supported, which covers nearly all
+   images found in photo albums.  */
+
+static unsigned int
+get_be16 (const unsigned char *p)
+{
+  return ((unsigned int) p[0] << 8) | p[1];
+}
+
+static unsigned int
+get_be32 (const unsigned char *p)
+{
+  return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) |
+    ((unsigned int) p[2] << 8) | p[3];
+}
+
+/* Search the first SOFn marker, it contains the dimensions.  */
+static int
+get_jpeg_dimensions (FILE *fp, unsigned int *width, unsigned int *height)
+{
+  unsigned char buf[7];
+  int c;
+
+  while (1)
+    {
+      unsigned int len;
+
+      /* markers may be padded with any number of 0xff */
+      c = fgetc (fp);
+      if (c != 0xff)
+	return -1;
+      while ((c = fgetc (fp)) == 0xff)
+	;
+      if (c == EOF || c == 0xd9 /* EOI */ || c == 0xda /* SOS */)
+	return -1;
+      if (c == 0x01 || (c >= 0xd0 && c <= 0xd7))
+	continue; /* markers without length */
+
+      if (fread (buf, 1, 2, fp) != 2)
+	return -1;
+      len = get_be16 (buf);
+      if (len < 2)
+	return -1;
+
+      if (c >= 0xc0 && c <= 0xcf && c != 0xc4 /* DHT */ &&
+	  c != 0xc8 /* JPG */ && c != 0xcc /* DAC */)
+	{
+	  if (len < 7 || fread (buf, 1, 5, fp) != 5)
+	    return -1;
+	  *height = get_be16 (&buf[1]);
+	  *width = get_be16 (&buf[3]);
+	  return (*width > 0 && *height > 0) ? 0 : -1;
+	}
+
+      if (fseek (fp, len - 2, SEEK_CUR) != 0)
+	return -1;
+    }
+}
+
+/* Returns 0 on success, -1 if the format is not known or the header
+   is broken.  */
+int
+get_image_dimensions (const char *filename, unsigned int *width,
+		      unsigned int *height)
+{
+  static const unsigned char png_magic[8] =
+    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  unsigned char buf[24];
+  int ret = -1;
+  FILE *fp;
+
+  count_syscall (SYS_OPEN);
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return -1;
+
+  if (fread (buf, 1, 2, fp) == 2 && buf[0] == 0xff && buf[1] == 0xd8)
+    ret = get_jpeg_dimensions (fp, width, height);
+  else if (fread (&buf[2], 1, sizeof (buf) - 2, fp) == sizeof (buf) - 2 &&
+	   memcmp (buf, png_magic, sizeof (png_magic)) == 0 &&
+	   memcmp (&buf[12], "IHDR", 4) == 0)
+    {
+      *width = get_be32 (&buf[16]);
+      *height = get_be32 (&buf[20]);
+      if (*width > 0 && *height > 0)
+	ret = 0;
+    }
+
+  fclose (fp);
+  return ret;
+}
@@ -0,0 +1,211 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "main.h"
+
+/* Nail jobs run in child processes: imlib2 keeps its state in
+   global variables, so every worker needs its own address space.
+   This also makes sure a crashing decoder only kills one job.
+   Jobs are only started as long as the estimated memory of all
+   running jobs stays below memory_limit, so that huge images are
+   decoded alone while small ones run in parallel. */
+
+int max_jobs = 1;
+unsigned long long memory_limit = 0; /* 0 means no limit */
+
+typedef struct job_t {
+  pid_t pid;    /* pid of the worker, 0 if slot is free */
+  char *srcdir; /* path to image */
+  char *dstdir; /* where the nails are created */
+  char *fname;  /* name of image file */
+  nail_t nails[MAX_NAILS]; /* nails created by this job */
+  int count;    /* number of nails */
+  config_t config; /* config of the directory, which could be freed
+		      before the job is finished */
+  unsigned long long memory; /* estimated memory usage */
+  manifest_t *manifest; /* yapa/nails, written after the job */
+} job_t;
+
+static job_t *jobs = NULL;
+static int nr_running = 0;
+static unsigned long long memory_in_use = 0;
+
+static void
+report_failed_job (const char *srcdir, const char *dstdir, const char *fname,
+		   const nail_t *nails, int count, const config_t *config)
+{
+  fprintf (stderr, _("ERROR: Couldn't create nails for %s/%s, skipping\n"),
+	   srcdir, fname);
+  /* the parameters of the nails are already recorded in yapa/nails,
+     a missing nail will be created again by the next run */
+  remove_nails (dstdir, fname, nails, count, config);
+}
+
+/* Wait until one worker has finished and free its slot.  */
+static void
+reap_job (void)
+{
+  int status, i;
+  pid_t pid;
+
+  renew_locks ();
+
+  do
+    pid = waitpid (-1, &status, 0);
+  while (pid < 0 && errno == EINTR);
+
+  if (pid < 0)
+    {
+      fprintf (stderr, "ERROR: waitpid: %m\n");
+      abort ();
+    }
+
+  for (i = 0; i < max_jobs; i++)
+    if (jobs[i].pid == pid)
+      break;
+
+  if (i == max_jobs) /* not one of ours */
+    return;
+
+  if (WIFSIGNALED (status))
+    {
+      fprintf (stderr, _("ERROR: Nail worker for %s/%s killed by signal %d\n"),
+	       jobs[i].srcdir, jobs[i].fname, WTERMSIG (status));
+      report_failed_job (jobs[i].srcdir, jobs[i].dstdir, jobs[i].fname,
+			 jobs[i].nails, jobs[i].count, &jobs[i].config);
+    }
+  else if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    report_failed_job (jobs[i].srcdir, jobs[i].dstdir, jobs[i].fname,
+		       jobs[i].nails, jobs[i].count, &jobs[i].config);
+
+  release_manifest (jobs[i].manifest);
+  free (jobs[i].srcdir);
+  free (jobs[i].dstdir);
+  free (jobs[i].fname);
+  jobs[i].pid = 0;
+  memory_in_use -= jobs[i].memory;
+  --nr_running;
+}
+
+/* Create the nails of one image. With more than one job the work
+   is done by a worker process and this function returns as soon
+   as a worker slot is free. The manifest of the directory is held
+   until the worker is finished.  */
+void
+add_nail_job (const char *srcdir, const char *dstdir, const char *fname,
+	      nail_t *nails, int count, const config_t *config,
+	      manifest_t *manifest)
+{
+  unsigned long long memory;
+  pid_t pid;
+  int i;
+
+  if (count <= 0)
+    return;
+
+  if (max_jobs <= 1)
+    {
+      /* reap_job is never called, the lease would expire during a
+	 big directory */
+      renew_locks ();
+      if (create_nails (srcdir, dstdir, fname, nails, count, config) != 0)
+	report_failed_job (srcdir, dstdir, fname, nails, count, config);
+      return;
+    }
+
+  if (jobs == NULL)
+    {
+      jobs = calloc (max_jobs, sizeof (job_t));
+      if (jobs == NULL)
+	yapa_oom ();
+    }
+
+  memory = estimate_nail_memory (srcdir, fname, nails, count);
+  if (debug_flag)
+    printf ("========>MEMORY: %s/%s needs ~%llu MB\n", srcdir, fname,
+	    memory >> 20);
+
+  /* A job which alone needs more than the limit has to wait until
+     all others are finished and runs alone.  */
+  while (nr_running >= max_jobs ||
+	 (nr_running > 0 && memory_limit > 0 &&
+	  memory_in_use + memory > memory_limit))
+    reap_job ();
+
+  /* don't let the worker print our buffered output again */
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+  if (pid < 0)
+    {
+      fprintf (stderr, "WARNING: fork: %m, creating nails directly\n");
+      if (create_nails (srcdir, dstdir, fname, nails, count, config) != 0)
+	report_failed_job (srcdir, dstdir, fname, nails, count, config);
+      return;
+    }
+
+  if (pid == 0)
+    {
+      int ret = create_nails (srcdir, dstdir, fname, nails, count, config);
+      fflush (stdout);
+      fflush (stderr);
+      _exit (ret == 0 ? 0 : 1);
+    }
+
+  for (i = 0; i < max_jobs; i++)
+    if (jobs[i].pid == 0)
+      break;
+
+  jobs[i].pid = pid;
+  jobs[i].srcdir = strdup (srcdir);
+  jobs[i].dstdir = strdup (dstdir);
+  jobs[i].fname = strdup (fname);
+  if (jobs[i].srcdir == NULL || jobs[i].dstdir == NULL ||
+      jobs[i].fname == NULL)
+    yapa_oom ();
+  memcpy (jobs[i].nails, nails, count * sizeof (nail_t));
+  jobs[i].count = count;
+  jobs[i].config = *config;
+  jobs[i].memory = memory;
+  jobs[i].manifest = manifest;
+  hold_manifest (manifest);
+  memory_in_use += memory;
+  ++nr_running;
+}
+
+/* Wait until all nail jobs are finished.  */
+void
+wait_for_jobs (void)
+{
+  while (nr_running > 0)
+    reap_job ();
+
+  free (jobs);
+  jobs = NULL;
+}
@@ -0,0 +1,407 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LIBJPEG
+
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "main.h"
+
+struct jpeg_error_handler {
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+static void
+jpeg_error_exit (j_common_ptr cinfo)
+{
+  struct jpeg_error_handler *err =
+    (struct jpeg_error_handler *) cinfo->err;
+
+  if (debug_flag)
+    (*cinfo->err->output_message) (cinfo);
+
+  longjmp (err->setjmp_buffer, 1);
+}
+
+static void
+jpeg_output_message (j_common_ptr cinfo)
+{
+  char buf[JMSG_LENGTH_MAX];
+
+  /* imlib2 is used as fallback and will complain itself */
+  if (!debug_flag)
+    return;
+
+  (*cinfo->err->format_message) (cinfo, buf);
+  fprintf (stderr, "libjpeg: %s\n", buf);
+}
+
+/* Select the smallest DCT scaling factor for which the decoded image
+   is still at least min_size pixels big in the bigger dimension. */
+static void
+jpeg_select_scale (struct jpeg_decompress_struct *cinfo, int min_size)
+{
+  unsigned int num;
+
+  for (num = 1; num < 8; num++)
+    {
+      unsigned int out_width, out_height;
+
+      cinfo->scale_num = num;
+      cinfo->scale_denom = 8;
+      jpeg_calc_output_dimensions (cinfo);
+      out_width = cinfo->output_width;
+      out_height = cinfo->output_height;
+
+      if ((out_width > out_height ? out_width : out_height) >=
+	  (unsigned int) min_size)
+	return;
+    }
+
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = 1;
+}
+
+/* Decode a JPEG image from fp or from memory, scaled down in the
+   DCT domain as far as possible for a nail of max. min_size pixels.
+   Returns the image as ARGB data in the layout imlib2 uses, or NULL
+   in case of an error.  */
+static uint32_t *
+load_jpeg (FILE *fp, const unsigned char *mem, unsigned long memlen,
+	   int min_size, unsigned int *width, unsigned int *height,
+	   unsigned int *orig_width, unsigned int *orig_height)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_handler jerr;
+  uint32_t * volatile data = NULL;
+  JSAMPLE * volatile rgb = NULL;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit;
+  jerr.pub.output_message = jpeg_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      jpeg_destroy_decompress (&cinfo);
+      free (data);
+      free (rgb);
+      return NULL;
+    }
+
+  jpeg_create_decompress (&cinfo);
+  if (fp != NULL)
+    jpeg_stdio_src (&cinfo, fp);
+  else
+    jpeg_mem_src (&cinfo, mem, memlen);
+  jpeg_read_header (&cinfo, TRUE);
+
+  *orig_width = cinfo.image_width;
+  *orig_height = cinfo.image_height;
+
+  /* This is only the first step, the nail is created by a
+     high quality resample of the result.  */
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.do_fancy_upsampling = FALSE;
+  jpeg_select_scale (&cinfo, min_size);
+#ifdef JCS_EXTENSIONS
+  /* libjpeg-turbo can write the imlib2 pixel format directly */
+#ifdef WORDS_BIGENDIAN
+  cinfo.out_color_space = JCS_EXT_ARGB;
+#else
+  cinfo.out_color_space = JCS_EXT_BGRA;
+#endif
+#else
+  cinfo.out_color_space = JCS_RGB;
+#endif
+
+  jpeg_start_decompress (&cinfo);
+
+  *width = cinfo.output_width;
+  *height = cinfo.output_height;
+
+  data = malloc ((size_t) *width * *height * sizeof (uint32_t));
+  if (data == NULL)
+    yapa_oom ();
+
+#ifndef JCS_EXTENSIONS
+  rgb = malloc ((size_t) *width * 3);
+  if (rgb == NULL)
+    yapa_oom ();
+#endif
+
+  while (cinfo.output_scanline < cinfo.output_height)
+    {
+      uint32_t *dst = data + (size_t) cinfo.output_scanline * *width;
+#ifdef JCS_EXTENSIONS
+      JSAMPROW row = (JSAMPROW) dst;
+
+      jpeg_read_scanlines (&cinfo, &row, 1);
+#else
+      JSAMPROW row = rgb;
+      unsigned int x;
+
+      jpeg_read_scanlines (&cinfo, &row, 1);
+      for (x = 0; x < *width; x++)
+	dst[x] = 0xff000000 | ((uint32_t) rgb[3 * x] << 16) |
+	  ((uint32_t) rgb[3 * x + 1] << 8) | rgb[3 * x + 2];
+#endif
+    }
+
+  jpeg_finish_decompress (&cinfo);
+  jpeg_destroy_decompress (&cinfo);
+  free (rgb);
+
+  if (debug_flag)
+    printf ("========>JPEG: %ux%u decoded as %ux%u\n", *orig_width,
+	    *orig_height, *width, *height);
+
+  return data;
+}
+
+/* Decode a JPEG file, see load_jpeg.  */
+uint32_t *
+load_jpeg_scaled (const char *filename, int min_size,
+		  unsigned int *width, unsigned int *height,
+		  unsigned int *orig_width, unsigned int *orig_height)
+{
+  uint32_t *data;
+  FILE *fp;
+
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  data = load_jpeg (fp, NULL, 0, min_size, width, height,
+		    orig_width, orig_height);
+  fclose (fp);
+
+  return data;
+}
+
+/* Decode a JPEG image in memory without any scaling.  */
+uint32_t *
+load_jpeg_mem (const unsigned char *mem, unsigned long memlen,
+	       unsigned int *width, unsigned int *height)
+{
+  unsigned int orig_width, orig_height;
+
+  return load_jpeg (NULL, mem, memlen, INT_MAX, width, height,
+		    &orig_width, &orig_height);
+}
+
+/* Read only the size of a JPEG file from its header.
+   Returns 0 on success, -1 on error.  */
+int
+get_jpeg_size (const char *filename, unsigned int *width,
+	       unsigned int *height)
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_handler jerr;
+  FILE *fp;
+
+  fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return -1;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit;
+  jerr.pub.output_message = jpeg_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      jpeg_destroy_decompress (&cinfo);
+      fclose (fp);
+      return -1;
+    }
+
+  jpeg_create_decompress (&cinfo);
+  jpeg_stdio_src (&cinfo, fp);
+  jpeg_read_header (&cinfo, TRUE);
+  *width = cinfo.image_width;
+  *height = cinfo.image_height;
+  jpeg_destroy_decompress (&cinfo);
+  fclose (fp);
+
+  return 0;
+}
+
+/* libjpeg decodes an image as stored, rotate and flip it as the
+   EXIF Orientation tells, like the JPEG loader of imlib2 does. The
+   data is replaced, width and height are swapped for orientations
+   5 to 8.  */
+uint32_t *
+orient_image (uint32_t *data, unsigned int *width, unsigned int *height,
+	      int orientation)
+{
+  size_t w = *width, h = *height;
+  ptrdiff_t base, xstep, ystep;
+  uint32_t *rotated;
+  size_t x, y;
+
+  /* index of the source pixel 0,0 in the result and the steps of
+     one pixel to the right and one row down */
+  switch (orientation)
+    {
+    case 2: /* mirrored */
+      base = w - 1; xstep = -1; ystep = w;
+      break;
+    case 3: /* rotated by 180 degrees */
+      base = h * w - 1; xstep = -1; ystep = -(ptrdiff_t) w;
+      break;
+    case 4: /* upside down */
+      base = (h - 1) * w; xstep = 1; ystep = -(ptrdiff_t) w;
+      break;
+    case 5: /* transposed */
+      base = 0; xstep = h; ystep = 1;
+      break;
+    case 6: /* rotated by 90 degrees clockwise */
+      base = h - 1; xstep = h; ystep = -1;
+      break;
+    case 7: /* transversed */
+      base = w * h - 1; xstep = -(ptrdiff_t) h; ystep = -1;
+      break;
+    case 8: /* rotated by 90 degrees counterclockwise */
+      base = (w - 1) * h; xstep = -(ptrdiff_t) h; ystep = 1;
+      break;
+    default:
+      return data;
+    }
+
+  rotated = malloc (w * h * sizeof (uint32_t));
+  if (rotated == NULL)
+    yapa_oom ();
+
+  for (y = 0; y < h; y++)
+    {
+      const uint32_t *src = data + y * w;
+      ptrdiff_t i = base + (ptrdiff_t) y * ystep;
+
+      for (x = 0; x < w; x++, i += xstep)
+	rotated[i] = src[x];
+    }
+  free (data);
+
+  if (orientation >= 5)
+    {
+      *width = h;
+      *height = w;
+    }
+
+  return rotated;
+}
+
+/* Write an image in the ARGB layout of imlib2 as JPEG file.
+   Returns 0 on success, -1 on error.  */
+int
+save_jpeg (const char *filename, const uint32_t *data, unsigned int width,
+	   unsigned int height, int quality, int progressive, int optimize)
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_handler jerr;
+  JSAMPLE * volatile rgb = NULL;
+  FILE *fp;
+
+  fp = fopen (filename, "wb");
+  if (fp == NULL)
+    return -1;
+
+  cinfo.err = jpeg_std_error (&jerr.pub);
+  jerr.pub.error_exit = jpeg_error_exit;
+  jerr.pub.output_message = jpeg_output_message;
+
+  if (setjmp (jerr.setjmp_buffer))
+    {
+      jpeg_destroy_compress (&cinfo);
+      fclose (fp);
+      unlink (filename);
+      free (rgb);
+      errno = EIO;
+      return -1;
+    }
+
+  jpeg_create_compress (&cinfo);
+  jpeg_stdio_dest (&cinfo, fp);
+
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+#ifdef JCS_EXTENSIONS
+  cinfo.input_components = 4;
+#ifdef WORDS_BIGENDIAN
+  cinfo.in_color_space = JCS_EXT_ARGB;
+#else
+  cinfo.in_color_space = JCS_EXT_BGRA;
+#endif
+#else
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  rgb = malloc ((size_t) width * 3);
+  if (rgb == NULL)
+    yapa_oom ();
+#endif
+
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, quality, TRUE);
+  if (progressive)
+    jpeg_simple_progression (&cinfo);
+  cinfo.optimize_coding = optimize ? TRUE : FALSE;
+
+  jpeg_start_compress (&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height)
+    {
+      const uint32_t *src = data + (size_t) cinfo.next_scanline * width;
+#ifdef JCS_EXTENSIONS
+      JSAMPROW row = (JSAMPROW) src;
+#else
+      JSAMPROW row = rgb;
+      unsigned int x;
+
+      for (x = 0; x < width; x++)
+	{
+	  rgb[3 * x] = (src[x] >> 16) & 0xff;
+	  rgb[3 * x + 1] = (src[x] >> 8) & 0xff;
+	  rgb[3 * x + 2] = src[x] & 0xff;
+	}
+#endif
+      jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  free (rgb);
+
+  if (fclose (fp) != 0)
+    {
+      unlink (filename);
+      return -1;
+    }
+
+  return 0;
+}
+
+#endif /* HAVE_LIBJPEG */
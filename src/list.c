@@ -0,0 +1,264 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+/* The images, text, html and gpx files and the subdirectories of a
+   directory are kept in a list_t in the order they were added or
+   sorted. All entry types start with name, prev and next like
+   list_entry_t. Appending needs the last entry, looking up an entry
+   by name a hash table. The hash table is only built when the first
+   lookup happens, most lists are never searched. If a name is added
+   twice, a lookup finds the first entry like a walk through the list
+   would do.  */
+
+static void
+build_index (list_t *list)
+{
+  list_entry_t *entry;
+
+  list->index = hash_create (list->count);
+  for (entry = list->first; entry != NULL; entry = entry->next)
+    if (entry->name != NULL && hash_lookup (list->index, entry->name) == NULL)
+      hash_insert (list->index, entry->name, entry);
+}
+
+static void
+drop_index (list_t *list)
+{
+  hash_free (list->index, NULL);
+  list->index = NULL;
+  list->duplicates = 0;
+}
+
+void
+list_append (list_t *list, void *ptr)
+{
+  list_entry_t *entry = ptr, *last = list->last;
+
+  entry->prev = last;
+  entry->next = NULL;
+  if (last == NULL)
+    list->first = entry;
+  else
+    last->next = entry;
+  list->last = entry;
+  list->count++;
+
+  if (list->index != NULL && entry->name != NULL)
+    {
+      if (hash_lookup (list->index, entry->name) == NULL)
+	hash_insert (list->index, entry->name, entry);
+      else
+	list->duplicates = 1;
+    }
+}
+
+void *
+list_lookup (list_t *list, const char *name)
+{
+  if (list->first == NULL)
+    return NULL;
+  if (list->index == NULL)
+    build_index (list);
+
+  return hash_lookup (list->index, name);
+}
+
+/* Remove entry from the list, the entry itself is not freed.  */
+void
+list_unlink (list_t *list, void *ptr)
+{
+  list_entry_t *entry = ptr;
+
+  if (entry->prev == NULL)
+    list->first = entry->next;
+  else
+    entry->prev->next = entry->next;
+  if (entry->next == NULL)
+    list->last = entry->prev;
+  else
+    entry->next->prev = entry->prev;
+  entry->prev = NULL;
+  entry->next = NULL;
+  list->count--;
+
+  if (list->index != NULL && entry->name != NULL &&
+      hash_lookup (list->index, entry->name) == entry)
+    {
+      /* another entry with the same name is not in the index */
+      if (list->duplicates)
+	drop_index (list);
+      else
+	hash_remove (list->index, entry->name);
+    }
+}
+
+/* Remove the entry with name from the list and return it, or NULL
+   if there is none.  */
+void *
+list_remove (list_t *list, const char *name)
+{
+  void *entry = list_lookup (list, name);
+
+  if (entry != NULL)
+    list_unlink (list, entry);
+  return entry;
+}
+
+/* Put new at the place of old, which is removed from the list.  */
+void
+list_replace (list_t *list, void *old_ptr, void *new_ptr)
+{
+  list_entry_t *old = old_ptr, *new = new_ptr;
+
+  new->prev = old->prev;
+  new->next = old->next;
+  if (old->prev == NULL)
+    list->first = new;
+  else
+    old->prev->next = new;
+  if (old->next == NULL)
+    list->last = new;
+  else
+    old->next->prev = new;
+  old->prev = NULL;
+  old->next = NULL;
+
+  /* the names could differ */
+  if (list->index != NULL)
+    drop_index (list);
+}
+
+/* Move all entries of other to the end of list, other is empty
+   afterwards.  */
+void
+list_concat (list_t *list, list_t *other)
+{
+  list_entry_t *first = other->first;
+
+  if (first == NULL)
+    {
+      list_clear (other);
+      return;
+    }
+
+  if (list->last == NULL)
+    list->first = first;
+  else
+    ((list_entry_t *) list->last)->next = first;
+  first->prev = list->last;
+  list->last = other->last;
+  list->count += other->count;
+
+  if (list->index != NULL)
+    drop_index (list);
+  list_clear (other);
+}
+
+/* Sort the entries by name with a stable bottom-up merge sort,
+   which needs no memory and O(n log n) comparisons. Natural order
+   compares numbers in the names by value, so IMG_9 comes before
+   IMG_10.  */
+void
+list_sort (list_t *list, int natural)
+{
+  int (*compare) (const char *, const char *) = natural ? strverscmp : strcmp;
+  list_entry_t *head = list->first, *tail = NULL;
+  size_t width;
+
+  if (head == NULL)
+    return;
+
+  /* merge runs of width entries, until one run is left */
+  for (width = 1; ; width *= 2)
+    {
+      list_entry_t *p = head;
+      size_t merges = 0;
+
+      head = NULL;
+      tail = NULL;
+      while (p != NULL)
+	{
+	  list_entry_t *q = p;
+	  size_t i, psize = 0, qsize = width;
+
+	  merges++;
+	  for (i = 0; i < width && q != NULL; i++)
+	    {
+	      psize++;
+	      q = q->next;
+	    }
+
+	  while (psize > 0 || (qsize > 0 && q != NULL))
+	    {
+	      list_entry_t *entry;
+
+	      /* on equal names the one of the first run wins */
+	      if (psize > 0 &&
+		  (qsize == 0 || q == NULL || compare (p->name, q->name) <= 0))
+		{
+		  entry = p;
+		  p = p->next;
+		  psize--;
+		}
+	      else
+		{
+		  entry = q;
+		  q = q->next;
+		  qsize--;
+		}
+
+	      if (tail == NULL)
+		head = entry;
+	      else
+		tail->next = entry;
+	      entry->prev = tail;
+	      tail = entry;
+	    }
+	  p = q;
+	}
+      tail->next = NULL;
+
+      if (merges <= 1)
+	break;
+    }
+
+  list->first = head;
+  list->last = tail;
+
+  /* a lookup has to find the first of the entries with the same name */
+  if (list->duplicates)
+    drop_index (list);
+}
+
+/* Forget all entries, which have to be freed by the caller.  */
+void
+list_clear (list_t *list)
+{
+  drop_index (list);
+  list->first = NULL;
+  list->last = NULL;
+  list->count = 0;
+}
@@ -0,0 +1,310 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "main.h"
+
+/* With --cooperate several yapa processes, also on different hosts
+   sharing the album over NFS, can work on the same album. Before a
+   directory is updated, <dir>/yapa/lock is created with O_EXCL, a
+   directory with a lock of another process is skipped. The locks are
+   kept until the nails of the directory are created at the end of the
+   run. The modification time of a lock is the lease: it is renewed
+   while yapa is running, a lock not renewed for LOCK_LEASE seconds
+   belongs to a crashed process and is removed. The lease is checked
+   against the clock of the file server, the clocks of the hosts
+   could differ. Removing a stale lock can race with its creation by
+   another process, so the owner checks with verify_lock that it
+   still holds the lock before writing nails and pages.  */
+
+#define LOCK_LEASE 600
+
+int use_locks = 0;
+
+static char **held_locks = NULL;
+static size_t nr_held = 0;
+static time_t last_renewal = 0;
+static char *lock_owner = NULL;
+
+/* "<hostname> <pid>", pids are only unique on one host */
+static const char *
+get_lock_owner (void)
+{
+  if (lock_owner == NULL)
+    {
+      char host[256];
+
+      if (gethostname (host, sizeof (host)) != 0)
+	strcpy (host, "localhost");
+      host[sizeof (host) - 1] = '\0';
+      if (asprintf (&lock_owner, "%s %ld", host, (long) getpid ()) < 0)
+	yapa_oom ();
+    }
+  return lock_owner;
+}
+
+/* Returns 1 if the lock was created, 0 if it exists already and -1 on
+   other errors.  */
+static int
+create_lock (const char *lockfile)
+{
+  const char *owner = get_lock_owner ();
+  size_t len = strlen (owner);
+  int fd;
+
+  count_syscall (SYS_OPEN);
+  fd = open (lockfile, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return errno == EEXIST ? 0 : -1;
+
+  if (write (fd, owner, len) != (ssize_t) len || close (fd) != 0)
+    {
+      fprintf (stderr, _("ERROR: Cannot write %s: %m\n"), lockfile);
+      unlink (lockfile);
+      return -1;
+    }
+
+  return 1;
+}
+
+/* A file name only this process uses: LOCKFILE.SUFFIX.OWNER  */
+static char *
+private_name (const char *lockfile, const char *suffix)
+{
+  char *name;
+
+  if (asprintf (&name, "%s.%s.%s", lockfile, suffix,
+		get_lock_owner ()) < 0)
+    yapa_oom ();
+  /* the owner contains a space, don't use it in file names */
+  *strrchr (name, ' ') = '.';
+
+  return name;
+}
+
+static int
+is_own_lock (const char *lockfile)
+{
+  const char *owner = get_lock_owner ();
+  size_t len = strlen (owner);
+  char buf[300];
+  ssize_t n;
+  int fd;
+
+  count_syscall (SYS_OPEN);
+  fd = open (lockfile, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  n = read (fd, buf, sizeof (buf));
+  close (fd);
+
+  return n == (ssize_t) len && memcmp (buf, owner, len) == 0;
+}
+
+/* The current time of the file server holding LOCKFILE: the mtime
+   of a file touched next to it. Returns -1 on error.  */
+static time_t
+server_time (const char *lockfile)
+{
+  char *name = private_name (lockfile, "now");
+  struct stat st;
+  int fd, ret;
+
+  count_syscall (SYS_OPEN);
+  fd = open (name, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0)
+    {
+      free (name);
+      return -1;
+    }
+  /* a leftover of a crashed run keeps its old mtime otherwise */
+  ret = futimens (fd, NULL) == 0 && fstat (fd, &st) == 0;
+  close (fd);
+  unlink (name);
+  free (name);
+
+  return ret ? st.st_mtime : -1;
+}
+
+/* Remove a lock, whose lease has expired. Between checking and
+   removing the lock, another process could reclaim it, too, and
+   create a new one. So the lock is first renamed to a name only we
+   use, and put back if it was not the expired one. Returns 1 if the
+   lock should be created again, else 0.  */
+static int
+reclaim_stale_lock (const char *lockfile)
+{
+  struct stat st, st_moved;
+  char *tmpname;
+  time_t now;
+  int ret = 1;
+
+  count_syscall (SYS_STAT);
+  if (stat (lockfile, &st) != 0)
+    return errno == ENOENT;
+  /* without the time of the server, the lock is assumed to be alive */
+  now = server_time (lockfile);
+  if (now == (time_t) -1 || now - st.st_mtime <= LOCK_LEASE)
+    return 0;
+
+  tmpname = private_name (lockfile, "stale");
+
+  if (rename (lockfile, tmpname) != 0)
+    {
+      /* somebody else was faster */
+      free (tmpname);
+      return errno == ENOENT;
+    }
+
+  if (stat (tmpname, &st_moved) == 0 &&
+      (st_moved.st_ino != st.st_ino || st_moved.st_mtime != st.st_mtime))
+    {
+      /* this is the new lock of another process, if a third one
+	 created a lock in the meantime, that one wins and the other
+	 process notices it in verify_lock */
+      link (tmpname, lockfile);
+      ret = 0;
+    }
+  else
+    fprintf (stderr, _("WARNING: Removed stale lock %s\n"), lockfile);
+
+  unlink (tmpname);
+  free (tmpname);
+
+  return ret;
+}
+
+/* Try to get the lock of a directory. Returns 1 if this process may
+   update the directory, 0 if another process is working on it.  */
+int
+lock_directory (const char *directory)
+{
+  char *lockfile;
+  int tries, ret = 0;
+
+  renew_locks ();
+
+  if (asprintf (&lockfile, "%s/yapa/lock", directory) < 0)
+    yapa_oom ();
+
+  for (tries = 0; tries < 3; tries++)
+    {
+      ret = create_lock (lockfile);
+      if (ret != 0 || !reclaim_stale_lock (lockfile))
+	break;
+    }
+
+  if (ret < 0)
+    {
+      /* without yapa directory there is nothing to protect */
+      if (errno != ENOENT)
+	fprintf (stderr, _("WARNING: Cannot create %s: %m\n"), lockfile);
+      free (lockfile);
+      return 1;
+    }
+  if (ret == 0)
+    {
+      free (lockfile);
+      return 0;
+    }
+
+  /* grow the array whenever nr_held reaches a power of two */
+  if ((nr_held & (nr_held - 1)) == 0)
+    {
+      held_locks = realloc (held_locks, (nr_held ? nr_held * 2 : 1) *
+			    sizeof (char *));
+      if (held_locks == NULL)
+	yapa_oom ();
+    }
+  held_locks[nr_held++] = lockfile;
+
+  return 1;
+}
+
+/* Check before writing into DIRECTORY, that its lock was not taken
+   over by another process, see reclaim_stale_lock. Returns 1 if this
+   process may still update the directory.  */
+int
+verify_lock (const char *directory)
+{
+  size_t len = strlen (directory);
+  size_t i;
+
+  /* the directory updated is usually the one locked last */
+  for (i = nr_held; i-- > 0;)
+    if (strncmp (held_locks[i], directory, len) == 0 &&
+	strcmp (held_locks[i] + len, "/yapa/lock") == 0)
+      {
+	if (is_own_lock (held_locks[i]))
+	  return 1;
+	fprintf (stderr, _("WARNING: Lost lock %s to another process\n"),
+		 held_locks[i]);
+	return 0;
+      }
+
+  /* not locked, because it has no yapa directory */
+  return 1;
+}
+
+/* Extend the lease of all locks. Cheap enough to be called for every
+   nail job and html page.  */
+void
+renew_locks (void)
+{
+  time_t now;
+  size_t i;
+
+  if (nr_held == 0)
+    return;
+
+  now = time (NULL);
+  if (now - last_renewal < LOCK_LEASE / 4)
+    return;
+  last_renewal = now;
+
+  for (i = 0; i < nr_held; i++)
+    if (utimensat (AT_FDCWD, held_locks[i], NULL, 0) != 0)
+      fprintf (stderr, _("WARNING: Cannot renew %s: %m\n"), held_locks[i]);
+}
+
+/* Remove all locks, after the nails of the directories are created. */
+void
+unlock_directories (void)
+{
+  size_t i;
+
+  for (i = 0; i < nr_held; i++)
+    {
+      /* after a lease expired, it could belong to somebody else */
+      if (is_own_lock (held_locks[i]))
+	unlink (held_locks[i]);
+      free (held_locks[i]);
+    }
+  free (held_locks);
+  held_locks = NULL;
+  nr_held = 0;
+}
@@ -31,6 +31,8 @@
 #include <getopt.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#define X_DISPLAY_MISSING
+#include <Imlib2.h>
 
 #include "main.h"
 
@@ -51,6 +53,68 @@ warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n\
   /* fprintf (stdout, _("Written by %s.\n"), "Thorsten Kukuk"); */
 }
 
+/* Parse a size like 512M or 2G, without suffix the size is in MB.  */
+static int
+parse_size (const char *arg, unsigned long long *size)
+{
+  unsigned long long val;
+  char *ep;
+
+  errno = 0;
+  val = strtoull (arg, &ep, 10);
+  if (errno != 0 || ep == arg)
+    return -1;
+
+  switch (toupper (*ep))
+    {
+    case 'K':
+      val <<= 10;
+      ep++;
+      break;
+    case 'G':
+      val <<= 30;
+      ep++;
+      break;
+    case 'M':
+      ep++;
+      /* fall through */
+    case '\0':
+      val <<= 20;
+      break;
+    default:
+      return -1;
+    }
+
+  if (*ep != '\0')
+    return -1;
+
+  *size = val;
+  return 0;
+}
+
+/* Parse i/N of --shard, shards are counted from 1.  */
+static int
+parse_shard (const char *arg, int *shard, int *nr_shards)
+{
+  char *ep;
+  long i, n;
+
+  errno = 0;
+  i = strtol (arg, &ep, 10);
+  if (errno != 0 || ep == arg || *ep != '/')
+    return -1;
+  arg = ep + 1;
+  n = strtol (arg, &ep, 10);
+  if (errno != 0 || ep == arg || *ep != '\0')
+    return -1;
+  if (n < 1 || n > 1024 || i < 1 || i > n)
+    return -1;
+
+  *shard = i - 1;
+  *nr_shards = n;
+  return 0;
+}
+
 static void
 print_error (const char *program)
 {
@@ -65,11 +129,28 @@ print_help (const char *program)
   fprintf (stdout, _("%s - Yet Another Photo Album\n"), program);
   fprintf (stdout, _("Usage: %s [options] directory\n\n"), program);
 
+  fputs (_("      --cooperate   Share the work with other yapa processes\n"),
+	 stdout);
   fputs (_("  -d, --debug       Print debug messages\n"), stdout);
   fputs (_("  -f, --force       Recreate all html pages and thumb images\n"),
 	 stdout);
   fputs (_("      --force-html  Recreate all html pages\n"), stdout);
   fputs (_("      --force-nails Recreate all thumb imabes\n"), stdout);
+  fputs (_("  -j, --jobs N      Scan directories and create nails with N\n"
+	   "                    parallel jobs\n"), stdout);
+  fputs (_("      --memory-limit SIZE\n"
+	   "                    Max. memory for parallel nail jobs (e.g. 2G)\n"),
+	 stdout);
+  fputs (_("      --merge=N     Create the pages above the subtrees of N shards\n"),
+	 stdout);
+  fputs (_("      --no-cache    Read all directories again\n"), stdout);
+  fputs (_("      --shard=I/N   Create only the subtrees of shard I of N\n"),
+	 stdout);
+  fputs (_("      --stats       Print statistics about syscalls\n"), stdout);
+  fputs (_("      --stream      Update and free one directory after the other\n"),
+	 stdout);
+  fputs (_("      --watch       Update the album whenever files change\n"),
+	 stdout);
   fputs (_("  -v, --version     Print program version\n"), stdout);
   fputs (_("      --help        Give this help list\n"), stdout);
 }
@@ -81,245 +162,13 @@ yapa_oom (void)
   abort ();
 }
 
-/* Go recursive through all directories and create list
-   of images in every directroy. */
-static int
-go_through_dir (const char *directory, dir_l *dirs)
-{
-  DIR *dir = opendir (directory);
-  struct dirent *d;
-  struct stat st;
-  int found_meta_data = 0;
-  char *linksfile;
-
-  if (dir == NULL)
-    return 1;
-
-  if (!debug_flag)
-    printf (_("Import data from %s\n"), directory);
-
-  if (asprintf (&linksfile, "%s/yapa/links", directory) < 0)
-    yapa_oom ();
-
-  if (access (linksfile, R_OK) == 0)
-    {
-      /* open file with links to other images outside this directory */
-      FILE *fp = fopen (linksfile, "r");
-
-      if (!debug_flag)
-	printf (_("Import data from %s/yapa/links\n"), directory);
-
-      if (fp != NULL)
-	{
-	  char *buf = NULL;
-	  size_t buflen = 0;
-
-	  while (!feof (fp))
-	    {
-	      char *cp, *path;
-	      ssize_t n = getline (&buf, &buflen, fp);
-
-	      cp = buf;
-
-	      if (n < 1)
-		break;
-
-	      while (isspace ((int)*cp))    /* remove spaces and tabs */
-		++cp;
-	      if (*cp == '\0')        /* ignore empty lines */
-		continue;
-
-	      n = strlen (cp) - 1;
-	      if (cp[n] == '\n') /* remove trailing newline */
-		cp[n--] = '\0';
-	      while (n > 0 && isspace ((int)cp[n]))
-		cp[n--] = '\0';
-
-
-	      if (asprintf (&path, "%s/%s", directory, cp) < 0)
-		yapa_oom ();
-
-	      if (stat (path, &st) == 0)
-		{
-		  if ((strcasecmp (&cp[strlen (cp) - 4],
-				   ".jpg") == 0) ||
-		      (strcasecmp (&cp[strlen (cp) - 4],
-				   ".png") == 0))
-		    {
-		      char *srcdir, *newname;
-
-		      newname = strrchr (cp, '/');
-		      if (newname == NULL)
-			{
-			  newname = cp;
-			  srcdir = strdup (directory);
-			}
-		      else
-			{
-			  *newname++ = '\0';
-
-			  if (asprintf (&srcdir, "%s/%s",
-					directory, cp) < 0)
-			    yapa_oom ();
-			}
-
-		      if (debug_flag)
-			printf ("==> ");
-
-		      add_image (dirs, srcdir, directory, newname, st.st_mtime);
-		      free (srcdir);
-		    }
-		  else
-		    if (debug_flag)
-		      printf ("==> ignored\n");
-		}
-	      else
-		fprintf (stderr, "WARNING: file %s not found, ignoring\n", cp);
-
-	      free (path);
-	    }
-
-	  fclose (fp);
-
-	  if (!debug_flag)
-	    printf (_("Finished importing data from links\n"));
-	}
-    }
-
-  free (linksfile);
-
-  while ((d = readdir (dir)) != NULL)
-    {
-      char *buf;
-
-      if (debug_flag)
-	printf ("FOUND: %s ", d->d_name);
-      if (d->d_name[0] == '.')
-	{
-	  if (debug_flag)
-	    printf ("==> ignored\n");
-	  continue;
-	}
-
-      if (asprintf (&buf, "%s/%s", directory, d->d_name) < 0)
-	yapa_oom ();
-
-      stat (buf, &st);
-      if (S_ISDIR(st.st_mode))
-	{
-	  if (strcmp (d->d_name, "yapa") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ignored\n");
-	      found_meta_data = 1;
-	    }
-	  else if (strcmp (d->d_name, "picfolio") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ignored\n");
-	    }
-	  else if (strcmp (d->d_name, "GPXViewer") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ignored\n");
-	    }
-	  else
-	    {
-	      dir_l *subdir;
-	      if (debug_flag)
-		printf ("==> Go through Subdirectory\n");
-
-	      subdir = add_dir (&dirs->subdirs, directory, d->d_name);
-	      subdir->parentdir = dirs;
-	      subdir->config = get_config (subdir, dirs);
-
-	      go_through_dir (buf, subdir);
-	      /* Directory is empty, so don't add it */
-	      if (subdir->images == NULL && subdir->subdirs == NULL)
-		{
-		  subdir = get_and_delete_dir_entry (&dirs->subdirs,
-						     d->d_name);
-		  free (subdir->path);
-		  free (subdir->name);
-		  free (subdir);
-		}
-	    }
-	}
-      else if (S_ISREG(st.st_mode))
-	{
-	  if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".jpg") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ");
-	      add_image (dirs, directory, directory, d->d_name, st.st_mtime);
-	    }
-	  else if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".png") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ");
-	      add_image (dirs, directory, directory, d->d_name, st.st_mtime);
-	    }
-	  else if (strcasecmp (&d->d_name[strlen (d->d_name) - 5], ".html") == 0)
-	    {
-	      /* ignore index-*.html files */
-	      /* XXX yes, this means we will not delete index-*.html files */
-	      if (strncmp (d->d_name, "index-", 6) != 0)
-		{
-		  if (debug_flag)
-		    printf ("==> ");
-		  add_html (&dirs->html, directory, d->d_name, st.st_mtime);
-		}
-	    }
-	  else if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".txt") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ");
-	      add_txt (&dirs->texts, directory, d->d_name, st.st_mtime);
-	    }
-	  else if (strcasecmp (&d->d_name[strlen (d->d_name) - 4], ".gpx") == 0)
-	    {
-	      if (debug_flag)
-		printf ("==> ");
-	      add_gpx (&dirs->gpx, directory, d->d_name, st.st_mtime);
-	    }
-	  else if (debug_flag)
-	    printf ("==> ignored\n");
-	}
-      else if (debug_flag)
-	printf ("==> ignored\n");
-      free (buf);
-    }
-
-  closedir (dir);
-
-  if (found_meta_data == 0 &&
-      (dirs->subdirs != NULL || dirs->images != NULL))
-    {
-      char *cp;
-
-      if (asprintf (&cp, "%s/yapa", directory) < 0)
-	yapa_oom ();
-      mkdir (cp, 0755);
-      free (cp);
-      if (dirs->images)
-	{
-	  if (asprintf (&cp, "%s/yapa/midnails", directory) < 0)
-	    yapa_oom ();
-	  mkdir (cp, 0755);
-	  free (cp);
-	  if (asprintf (&cp, "%s/yapa/thumbnails", directory) < 0)
-	    yapa_oom ();
-	  mkdir (cp, 0755);
-	  free (cp);
-	}
-    }
-  return 0;
-}
-
 int
 main (int argc, char *argv[])
 {
   const char *program = "yapa";
+  int watch_flag = 0;
+  int stream_flag = 0;
+  int shard = 0, nr_shards = 0, merge_shards_nr = 0;
 
 #ifdef ENABLE_NLS
   setlocale(LC_ALL, "");
@@ -329,6 +178,14 @@ main (int argc, char *argv[])
 
   openlog (program, LOG_ODELAY | LOG_PID, LOG_AUTHPRIV);
 
+  max_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+
+  /* by default use max. half of the physical memory for nail jobs */
+  long pages = sysconf (_SC_PHYS_PAGES);
+  long page_size = sysconf (_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0)
+    memory_limit = (unsigned long long) pages * page_size / 2;
+
   while (1)
     {
       int c;
@@ -340,12 +197,21 @@ main (int argc, char *argv[])
 	{"force_html",  no_argument,       NULL, 501 },
 	{"force-nails", no_argument,       NULL, 502 },
 	{"force_nails", no_argument,       NULL, 502 },
+	{"jobs",        required_argument, NULL, 'j' },
+	{"memory-limit", required_argument, NULL, 503 },
+	{"stats",       no_argument,       NULL, 504 },
+	{"no-cache",    no_argument,       NULL, 505 },
+	{"watch",       no_argument,       NULL, 506 },
+	{"shard",       required_argument, NULL, 507 },
+	{"merge",       required_argument, NULL, 508 },
+	{"cooperate",   no_argument,       NULL, 509 },
+	{"stream",      no_argument,       NULL, 510 },
 	{"help",        no_argument,       NULL, 500 },
         {"version",     no_argument,       NULL, 'v' },
         {NULL,          0,                 NULL, '\0'}
       };
 
-      c = getopt_long (argc, argv, "dfv",
+      c = getopt_long (argc, argv, "dfj:v",
                        long_options, &option_index);
 
       if (c == (-1))
@@ -365,6 +231,58 @@ main (int argc, char *argv[])
 	case 502:
 	  force_nail_flag = 1;
 	  break;
+	case 'j':
+	  max_jobs = atoi (optarg);
+	  if (max_jobs < 1)
+	    {
+	      fprintf (stderr, _("%s: Invalid number of jobs: %s\n"),
+		       program, optarg);
+	      print_error (program);
+	      return 1;
+	    }
+	  break;
+	case 503:
+	  if (parse_size (optarg, &memory_limit) != 0)
+	    {
+	      fprintf (stderr, _("%s: Invalid memory limit: %s\n"),
+		       program, optarg);
+	      print_error (program);
+	      return 1;
+	    }
+	  break;
+	case 504:
+	  stats_flag = 1;
+	  break;
+	case 505:
+	  use_scan_cache = 0;
+	  break;
+	case 506:
+	  watch_flag = 1;
+	  break;
+	case 507:
+	  if (parse_shard (optarg, &shard, &nr_shards) != 0)
+	    {
+	      fprintf (stderr, _("%s: Invalid shard: %s\n"), program, optarg);
+	      print_error (program);
+	      return 1;
+	    }
+	  break;
+	case 508:
+	  merge_shards_nr = atoi (optarg);
+	  if (merge_shards_nr < 1)
+	    {
+	      fprintf (stderr, _("%s: Invalid number of shards: %s\n"),
+		       program, optarg);
+	      print_error (program);
+	      return 1;
+	    }
+	  break;
+	case 509:
+	  use_locks = 1;
+	  break;
+	case 510:
+	  stream_flag = 1;
+	  break;
         case 'v':
           print_version (program, "2007");
           return 0;
@@ -380,6 +298,18 @@ main (int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
+  if (max_jobs < 1)
+    max_jobs = 1;
+
+  /* Every log line of a nail worker should be written with a single
+     write call, so that lines of parallel jobs don't get mixed up. */
+  if (max_jobs > 1)
+    setvbuf (stdout, NULL, _IOLBF, 0);
+
+  /* Every image is only loaded once, so the imlib2 cache would only
+     keep huge decoded images in memory. */
+  imlib_set_cache_size (0);
+
   if (argc != 1)
     {
       fprintf (stderr, _("%s: Wrong number of arguments.\n"), program);
@@ -387,27 +317,107 @@ main (int argc, char *argv[])
       return 1;
     }
 
-  char *root_path = find_root_dir (argv[0]);
+  char *target = realpath (argv[0], NULL);
+  if (target == NULL)
+    {
+      fprintf (stderr, _("ERROR: %s: %m\n"), argv[0]);
+      return 1;
+    }
+
+  char *root_path = find_root_dir (target);
   if (root_path == NULL)
     {
-      root_path = realpath (argv[0], NULL);
+      root_path = strdup (target);
+      if (root_path == NULL)
+	yapa_oom ();
       printf (_("Create root configuration in %s\n"), root_path);
       create_root_config (root_path);
     }
 
-  dir_l *rootdir = NULL;
+  /* only a part of the album should be updated */
+  int subtree_flag = (strcmp (target, root_path) != 0);
+  if (subtree_flag && watch_flag)
+    {
+      fprintf (stderr, _("%s: --watch can only be used for the whole album\n"),
+	       program);
+      return 1;
+    }
+  if ((nr_shards > 0 || merge_shards_nr > 0) &&
+      (subtree_flag || watch_flag || (nr_shards > 0 && merge_shards_nr > 0)))
+    {
+      fprintf (stderr, _("%s: --shard and --merge can only be used alone for the whole album\n"),
+	       program);
+      return 1;
+    }
+  if (stream_flag &&
+      (subtree_flag || watch_flag || nr_shards > 0 || merge_shards_nr > 0))
+    {
+      fprintf (stderr, _("%s: --stream can only be used alone for the whole album\n"),
+	       program);
+      return 1;
+    }
+
+  dir_l *rootdir = new_dir (root_path, NULL);
+  int ret = 0;
 
-  add_dir (&rootdir, root_path, NULL);
   get_root_config (rootdir);
   rootdir->config = get_config (rootdir, NULL);
-  if (go_through_dir (root_path, rootdir) != 0)
-    abort ();
+  /* the cache would keep the whole album in memory */
+  if (stream_flag)
+    use_scan_cache = 0;
+  else
+    load_scan_cache (root_path);
+
+  if (stream_flag)
+    {
+      if (stream_album (root_path, rootdir) != 0)
+	abort ();
+      wait_for_jobs ();
+    }
+  else if (subtree_flag)
+    {
+      if (scan_subtree (root_path, rootdir, target) != 0)
+	ret = 1;
+      else
+	{
+	  save_scan_cache (0);
+	  set_stats_phase (PHASE_HTML);
+	  update_subtree (rootdir);
+	  wait_for_jobs ();
+	}
+    }
+  else
+    {
+      if (scan_directories (root_path, rootdir) != 0)
+	abort ();
+      /* the shards run at the same time, the cache is written by
+	 the merge step */
+      if (nr_shards == 0)
+	save_scan_cache (1);
+
+      set_stats_phase (PHASE_HTML);
+      if (nr_shards > 0)
+	update_shard (rootdir, shard, nr_shards);
+      else if (merge_shards_nr > 0)
+	merge_shards (rootdir, merge_shards_nr);
+      else
+	update_html (rootdir);
+      wait_for_jobs ();
+    }
+  unlock_directories ();
 
+  if (watch_flag)
+    ret = watch_album (root_path, &rootdir);
+
+  free_scan_cache ();
   free (root_path);
+  free (target);
 
-  update_html (rootdir);
+  if (stats_flag)
+    print_stats ();
 
-  free_dir (&rootdir);
+  free_dir (rootdir);
+  free_paths ();
 
-  return 0;
+  return ret;
 }
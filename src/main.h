@@ -17,6 +17,10 @@
 #ifndef _MAIN_H_
 #define _MAIN_H_
 
+#include <time.h>
+#include <stdint.h>
+#include <dirent.h>
+
 typedef struct config_t {
   int subdirformat; /* 0: table, 1: list with <LI> tags */
   int subdircols;   /* number of cols in a subdir table */
@@ -26,13 +30,62 @@ typedef struct config_t {
   int midnail;      /* size of midnails */
   int sort_dir;     /* 0: none, 1: add sorted to end, 2: sort all */
   int sort_img;     /* 0: none, 1: add sorted to end, 2: sort all */
+  int sort_dir_natural; /* sort directories like "ls -v" */
+  int sort_img_natural; /* sort images and gpx files like "ls -v" */
+  int exif_thumbnail; /* create thumbnails from embedded EXIF thumbnail */
+  int resample_filter; /* filter used to scale images, see resample.c */
+#define MAX_SRCSET 6
+  int srcset[MAX_SRCSET]; /* sizes of additional nails for srcset */
+  int srcset_count;       /* number of srcset sizes */
+  int nail_format;      /* format of the nails, see encoders.c */
+  int nail_quality;     /* quality of the nails, 0-100 */
+  int nail_progressive; /* write progressive JPEG nails */
+  int nail_optimize;    /* optimize JPEG huffman tables or compression */
+  int follow_symlinks;  /* FOLLOW_NEVER, FOLLOW_WITHIN_ROOT, FOLLOW_ALWAYS */
 } config_t;
 
+enum {
+  FOLLOW_NEVER = 0,
+  FOLLOW_WITHIN_ROOT,
+  FOLLOW_ALWAYS
+};
+
+enum {
+  NAIL_FORMAT_KEEP = 0,
+  NAIL_FORMAT_JPEG,
+  NAIL_FORMAT_WEBP,
+  NAIL_FORMAT_AVIF
+};
+
+enum {
+  FILTER_LANCZOS3 = 0,
+  FILTER_MITCHELL,
+  FILTER_BOX
+};
+
 #define MAX_EXIF_LINES 18
+
+/* All entries of a list_t start with these members, see list.c */
+typedef struct list_entry_t {
+  char *name;
+  struct list_entry_t *prev;
+  struct list_entry_t *next;
+} __attribute__((may_alias)) list_entry_t;
+
+typedef struct list_t {
+  void *first;
+  void *last;
+  size_t count;
+  struct hash_table_t *index; /* name -> entry, built by the first lookup */
+  int duplicates;             /* a name was added twice */
+} list_t;
+#define LIST_INIT { NULL, NULL, 0, NULL, 0 }
 typedef struct image_l {
   char *name;         /* name of image file */
-  char *srcdir;       /* path to image */
-  char *dstdir;       /* where html files should be created */
+  struct image_l *prev;
+  struct image_l *next;
+  const char *srcdir; /* path to image, shared */
+  const char *dstdir; /* where html files should be created, shared */
   char *label;        /* label of image used for html */
   time_t mtime;       /* last modification time of image */
   time_t html_mtime;  /* last modification time of html page */
@@ -42,50 +95,127 @@ typedef struct image_l {
   char *exif_val[MAX_EXIF_LINES]; /* exif value */
   char *exif_google_url;
   char *exif_osm_url;
-  struct image_l *prev;
-  struct image_l *next;
 } image_l;
 
 typedef struct txt_l {
   char *name;   /* name of text file */
-  char *path;   /* path to text file */
-  time_t mtime; /* last modification time of text file */
   struct txt_l *prev;
   struct txt_l *next;
+  const char *path; /* path to text file, shared */
+  time_t mtime; /* last modification time of text file */
 } txt_l;
 
 typedef struct gpx_l {
   char *name;   /* name of gpx file */
-  char *path;   /* path to gpx file */
-  char *label;  /* label of gpx file */
-  time_t mtime; /* last modification time of gpx file */
   struct gpx_l *prev;
   struct gpx_l *next;
+  const char *path; /* path to gpx file, shared */
+  char *label;  /* label of gpx file */
+  time_t mtime; /* last modification time of gpx file */
 } gpx_l;
 
+typedef struct nail_t {
+  char nailname[16]; /* name of the nail directory below yapa/ */
+  int size;          /* max. width and height of the nail */
+} nail_t;
+#define MAX_NAILS (2 + MAX_SRCSET)
+
+typedef struct manifest_l {
+  char *name;   /* <nailname>/<image> */
+  struct manifest_l *prev;
+  struct manifest_l *next;
+  char *params; /* parameters the nail was created with */
+} manifest_l;
+
+/* new yapa/nails of a directory, written when all users are done */
+typedef struct manifest_t {
+  char *yapadir;
+  struct arena_t *arena;  /* memory of the entries */
+  list_t entries;
+  int changed;            /* differs from the file */
+  int users;              /* update_nails and the running nail jobs */
+} manifest_t;
+
+/* entry of a directory as recorded in the scan cache */
+typedef struct scan_entry_t {
+  char *name;
+  int type;          /* DT_DIR or DT_REG */
+  time_t mtime;      /* modification time of files, 0 if cached */
+} scan_entry_t;
+
+typedef struct scan_dir_t {
+  unsigned long long ino;
+  struct timespec mtime;
+  size_t count;
+  scan_entry_t *entries;
+  struct arena_t *names;  /* memory of the names, NULL if malloc'ed */
+  int seen;          /* directory still exists */
+} scan_dir_t;
+
+typedef struct hash_table_t {
+  struct hash_entry_t **buckets;
+  size_t size;
+  size_t count;
+  struct arena_t *arena;  /* memory of the entries */
+} hash_table_t;
+typedef struct hash_entry_t hash_entry_t;
+
+/* compiled patterns of a .yapaignore file, see ignore.c */
+typedef struct ignore_pattern_t ignore_pattern_t;
+typedef struct ignore_t {
+  char *directory;             /* directory of the .yapaignore file */
+  size_t len;                  /* strlen (directory) */
+  ignore_pattern_t *patterns;
+  size_t count;
+  struct ignore_t *parent;     /* patterns of the directories above */
+} ignore_t;
+
+/* memory released all at once, see arena.c */
+typedef struct arena_t arena_t;
+
+/* path built in a reused buffer, see paths.c */
+typedef struct path_t {
+  char *str;               /* the path, always terminated */
+  size_t len;              /* length of str */
+  size_t size;             /* allocated size of str */
+  struct path_t *next;     /* unused paths of a thread */
+} path_t;
+
 typedef struct dir_l {
   char *name;              /* name of directory. NULL if top directory */
-  char *path;              /* path to directory */
+  struct dir_l *prev;
+  struct dir_l *next;
+  const char *path;        /* path to directory, shared */
   char *label;             /* label of directory */
-  image_l *images;         /* linked list of images in this directory */
-  txt_l *texts;            /* linked list of text files with descriptions */
-  txt_l *html;             /* linked list of html files */
-  gpx_l *gpx;              /* linked list of gpx files */
+  list_t images;           /* image_l list of images in this directory */
+  list_t texts;            /* txt_l list of text files with descriptions */
+  list_t html;             /* txt_l list of html files */
+  list_t gpx;              /* gpx_l list of gpx files */
   config_t config;         /* config options for HTML output */
   int force_html;          /* force recreation of html pages */
   time_t mtime;            /* Creation time of index*.html */
   time_t descr_mtime;      /* Last modification time of directroy.txt */
   time_t directory_mtime;  /* Last modification time of yapa/directory */
+  int has_meta_data;       /* directory contains a yapa subdirectory */
+  int shallow;             /* content was not scanned, see scan_subtree,
+			      or is the one of another entry (symlinks) */
+  int ancestor;            /* subdirectories are updated on their own */
+  ignore_t *ignore;        /* patterns valid for this directory */
+  int own_ignore;          /* ignore belongs to this directory */
+  int symlink;             /* directory is a symlink */
   struct dir_l *parentdir; /* pointer to data of parent directory */
-  struct dir_l *subdirs;   /* linked list of subdirectories */
-  struct dir_l *prev;
-  struct dir_l *next;
+  list_t subdirs;          /* dir_l list of subdirectories */
+  arena_t *arena;          /* entries and strings of the lists above */
+  int allocated;           /* entry and name are malloc'ed, not part
+			      of the arena of the parent */
 } dir_l;
 
 
 extern int debug_flag; /* enable debug messages */
 extern int force_html_flag; /* force recreation of all html files */
 extern int force_nail_flag; /* force recreation of all thumb files */
+extern int max_jobs; /* max. number of nail jobs running in parallel */
+extern unsigned long long memory_limit; /* max. memory for nail jobs */
 
 extern void yapa_oom (void);
 
@@ -97,49 +227,227 @@ extern void create_root_config (const char *rootdir);
 
 /* directories.c */
 extern char *find_root_dir (const char *start_dir);
-extern dir_l *add_dir (dir_l **dir, const char *path, const char *dirname);
-extern void free_dir (dir_l **dir);
-extern dir_l *get_and_delete_dir_entry (dir_l **dirs, const char *name);
+extern dir_l *new_dir (const char *path, const char *dirname);
+extern dir_l *add_dir (dir_l *parent, const char *path, const char *dirname);
+extern arena_t *dir_arena (dir_l *dir);
+extern dir_l *next_dir (const dir_l *top, dir_l *dir, int descend);
+extern void free_dir (dir_l *dir);
+extern void free_dirs (list_t *dirs);
+extern void free_dir_content (dir_l *dir);
+extern void update_directory (dir_l *dir);
 extern void update_html (dir_l *dir);
+extern void update_subtree (dir_l *dir);
+extern void read_directory_labels (dir_l *dir);
+
+
+/* scanner.c */
+extern int scan_directories (const char *root_path, dir_l *rootdir);
+extern int scan_subtree (const char *root_path, dir_l *rootdir,
+			 const char *target);
+extern int stream_album (const char *root_path, dir_l *rootdir);
+
+
+/* watch.c */
+extern int watch_album (const char *root_path, dir_l **rootdir);
 
 
 /* txtnotes.c */
-extern txt_l *add_txt (txt_l **descr, const char *path,
+extern txt_l *add_txt (dir_l *dir, const char *path,
 		       const char *filename, time_t mtime);
-extern txt_l *get_txt_entry (txt_l *txt, const char *name);
-extern void free_txt (txt_l **ptr);
+extern txt_l *get_txt_entry (list_t *txt, const char *name);
 
 /* gpx-tracks.c */
-extern gpx_l *add_gpx (gpx_l **descr, const char *path,
+extern gpx_l *add_gpx (dir_l *dir, const char *path,
                        const char *filename, time_t mtime);
-extern void free_gpx (gpx_l **ptr);
 extern void sort_gpx (dir_l *dir);
 
 /* htmlfiles.c */
-extern txt_l *add_html (txt_l **html, const char *path,
+extern txt_l *add_html (dir_l *dir, const char *path,
 			const char *filename, time_t mtime);
-extern txt_l *get_html_entry (txt_l *html, const char *name);
-extern txt_l *get_and_delete_html_entry (txt_l **html,
+extern txt_l *get_html_entry (list_t *html, const char *name);
+extern txt_l *get_and_delete_html_entry (list_t *html,
 					 const char *name);
 
 
 /* images.c */
-extern void create_nail (const char *srcdir, const char *dstdir,
-			 const char *fname, int size, const char *nailname);
+extern int create_nails (const char *srcdir, const char *dstdir,
+			 const char *fname, nail_t *nails, int count,
+			 const config_t *config);
+extern unsigned long long estimate_nail_memory (const char *srcdir,
+						const char *fname,
+						const nail_t *nails,
+						int count);
+extern int get_nail_size (unsigned int width, unsigned int height, int size,
+			  unsigned int *new_width, unsigned int *new_height);
+extern void remove_nails (const char *dstdir, const char *fname,
+			  const nail_t *nails, int count,
+			  const config_t *config);
 extern void add_image (dir_l *dir, const char *srcdir, const char *dstdir,
 		       const char *filename, time_t mtime);
-extern void free_images (image_l **img);
-extern void add_midnail (image_l **midnails, const char *path,
-			 const char *filename, time_t mtime);
-extern void add_thumbnail (image_l **thumbnails, const char *path,
-			   const char *filename, time_t mtime);
-extern image_l *get_and_delete_image_entry (image_l **image,
-					    const char *name);
+extern void add_nail (arena_t *arena, list_t *nails, const char *path,
+		      const char *filename, time_t mtime);
 extern void sort_images (dir_l *dir);
 
 
+/* jpeg.c */
+extern uint32_t *load_jpeg_scaled (const char *filename, int min_size,
+				   unsigned int *width, unsigned int *height,
+				   unsigned int *orig_width,
+				   unsigned int *orig_height);
+extern uint32_t *load_jpeg_mem (const unsigned char *mem,
+				unsigned long memlen,
+				unsigned int *width, unsigned int *height);
+extern int get_jpeg_size (const char *filename, unsigned int *width,
+			  unsigned int *height);
+extern uint32_t *orient_image (uint32_t *data, unsigned int *width,
+			       unsigned int *height, int orientation);
+extern int save_jpeg (const char *filename, const uint32_t *data,
+		      unsigned int width, unsigned int height, int quality,
+		      int progressive, int optimize);
+
+
+/* encoders.c */
+extern int get_nail_format (const char *name);
+extern const char *nail_format_name (int format);
+extern const char *get_nail_filename (path_t *nailfile, const char *fname,
+				      const config_t *config);
+extern int encode_nail (const char *filename, const char *fname,
+			const config_t *config);
+
+
+/* manifest.c */
+extern char *get_nail_params (const nail_t *nail, const config_t *config);
+extern void read_manifest (arena_t *arena, const char *yapadir,
+			   list_t *manifest);
+extern void write_manifest (const char *yapadir, list_t *manifest);
+extern manifest_t *create_manifest (const char *yapadir);
+extern void hold_manifest (manifest_t *manifest);
+extern void release_manifest (manifest_t *manifest);
+extern void add_manifest_entry (arena_t *arena, list_t *manifest,
+				const char *nailname, const char *fname,
+				const char *params);
+extern const char *get_manifest_entry (list_t *manifest,
+				       const char *nailname,
+				       const char *fname);
+
+
+/* imagesize.c */
+extern int get_image_dimensions (const char *filename, unsigned int *width,
+				 unsigned int *height);
+
+
+/* stats.c */
+enum { PHASE_SCAN = 0, PHASE_NAILS, PHASE_HTML, NR_PHASES };
+enum { SYS_OPENDIR = 0, SYS_READDIR, SYS_STAT, SYS_OPEN, NR_SYSCALLS };
+extern int stats_flag; /* print syscall statistics */
+extern int set_stats_phase (int phase);
+extern void count_syscall (int syscall);
+extern int stat_entry (int dirfd, const char *name, unsigned int *mode,
+		       time_t *mtime);
+extern int get_entry_type (int dirfd, const struct dirent *d);
+extern int stat_dir (const char *path, unsigned long long *dev,
+		     unsigned long long *ino, struct timespec *mtime);
+extern DIR *open_dir (const char *path);
+extern struct dirent *read_dir (DIR *dir);
+extern void print_stats (void);
+
+
+/* shard.c */
+extern void update_shard (dir_l *rootdir, int shard, int nr_shards);
+extern void merge_shards (dir_l *rootdir, int nr_shards);
+
+/* lock.c */
+extern int use_locks; /* lock directories, see --cooperate */
+extern int lock_directory (const char *directory);
+extern int verify_lock (const char *directory);
+extern void renew_locks (void);
+extern void unlock_directories (void);
+
+/* ignore.c */
+extern ignore_t *load_ignore_file (const char *directory, ignore_t *parent);
+extern int is_ignored (const ignore_t *ignore, const char *directory,
+		       const char *name, int is_dir);
+extern void free_ignore (ignore_t *ignore);
+
+/* list.c */
+extern void list_append (list_t *list, void *entry);
+extern void *list_lookup (list_t *list, const char *name);
+extern void list_unlink (list_t *list, void *entry);
+extern void *list_remove (list_t *list, const char *name);
+extern void list_replace (list_t *list, void *old_entry, void *new_entry);
+extern void list_concat (list_t *list, list_t *other);
+extern void list_sort (list_t *list, int natural);
+extern void list_clear (list_t *list);
+
+/* arena.c */
+extern arena_t *arena_create (void);
+extern void *arena_alloc (arena_t *arena, size_t size);
+extern char *arena_strdup (arena_t *arena, const char *s);
+extern void arena_free (arena_t *arena);
+
+/* paths.c */
+extern const char *intern_path (const char *path);
+extern path_t *path_get (void);
+extern void path_put (path_t *path);
+extern const char *path_set (path_t *path, const char *str);
+extern const char *path_add (path_t *path, const char *name);
+extern const char *path_append (path_t *path, const char *str);
+extern const char *path_truncate (path_t *path, size_t len);
+extern const char *path_dir (path_t *path, const dir_l *dir);
+extern void free_paths (void);
+
+/* hash.c */
+extern hash_table_t *hash_create (size_t size);
+extern void *hash_lookup (const hash_table_t *table, const char *key);
+extern void *hash_insert (hash_table_t *table, const char *key, void *value);
+extern void *hash_remove (hash_table_t *table, const char *key);
+extern const char *hash_intern (hash_table_t *table, const char *key);
+extern void hash_foreach (const hash_table_t *table,
+			  void (*func) (const char *key, void *value,
+					void *data),
+			  void *data);
+extern void hash_free (hash_table_t *table, void (*free_value) (void *value));
+
+
+/* scancache.c */
+extern int use_scan_cache; /* use the listings of the last run */
+extern void load_scan_cache (const char *root_path);
+extern scan_dir_t *lookup_scan_cache (const char *directory,
+				      unsigned long long ino,
+				      const struct timespec *mtime);
+extern void store_scan_cache (const char *directory, scan_dir_t *listing);
+extern void add_scan_entry (scan_dir_t *listing, const char *name, int type,
+			    time_t mtime);
+extern void free_scan_dir (void *listing);
+extern void save_scan_cache (int complete);
+extern void free_scan_cache (void);
+
+
+/* resample.c */
+extern int get_resample_filter (const char *name);
+extern const char *resample_filter_name (int filter);
+extern int set_resample_impl (const char *name);
+extern uint32_t *resample_image (const uint32_t *src,
+				 unsigned int src_width,
+				 unsigned int src_height,
+				 unsigned int dst_width,
+				 unsigned int dst_height, int filter);
+
+
+/* jobs.c */
+extern void add_nail_job (const char *srcdir, const char *dstdir,
+			  const char *fname, nail_t *nails, int count,
+			  const config_t *config, manifest_t *manifest);
+extern void wait_for_jobs (void);
+
+
 /* exif.c */
 extern void load_exif_data (image_l *img);
+extern void free_exif_data (image_l *img);
+extern int load_exif_orientation (const char *filename);
+extern unsigned char *load_exif_thumbnail (const char *filename,
+					   unsigned int *size,
+					   int *orientation);
 
 
 /* style.c */
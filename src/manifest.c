@@ -0,0 +1,214 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "main.h"
+
+/* yapa/nails records with which parameters every nail of a directory
+   was created, one line per nail:
+     <nailname>/<image>@<parameters>
+   If the parameters of a directory change, only the affected nails
+   are recreated. Increase NAIL_VERSION if the output of the nail
+   creation changes for the same parameters.  */
+
+#define NAIL_VERSION 1
+
+/* Returns the parameters a nail is created with as malloc'ed string.  */
+char *
+get_nail_params (const nail_t *nail, const config_t *config)
+{
+  char *params;
+
+  if (asprintf (&params, "size=%d filter=%s format=%s quality=%d "
+		"progressive=%d optimize=%d version=%d", nail->size,
+		resample_filter_name (config->resample_filter),
+		nail_format_name (config->nail_format), config->nail_quality,
+		config->nail_progressive ? 1 : 0,
+		config->nail_optimize ? 1 : 0, NAIL_VERSION) < 0)
+    yapa_oom ();
+
+  return params;
+}
+
+/* The entries are allocated from arena, which the caller frees.  */
+void
+add_manifest_entry (arena_t *arena, list_t *manifest, const char *nailname,
+		    const char *fname, const char *params)
+{
+  manifest_l *entry = arena_alloc (arena, sizeof (manifest_l));
+  size_t len = strlen (nailname);
+
+  entry->name = arena_alloc (arena, len + strlen (fname) + 2);
+  memcpy (entry->name, nailname, len);
+  entry->name[len] = '/';
+  strcpy (&entry->name[len + 1], fname);
+  entry->params = arena_strdup (arena, params);
+
+  list_append (manifest, entry);
+}
+
+/* Return the recorded parameters of a nail or NULL.  */
+const char *
+get_manifest_entry (list_t *manifest, const char *nailname,
+		    const char *fname)
+{
+  path_t *name = path_get ();
+  manifest_l *entry;
+
+  path_set (name, nailname);
+  entry = list_lookup (manifest, path_add (name, fname));
+  path_put (name);
+
+  return entry ? entry->params : NULL;
+}
+
+/* Read yapa/nails of a directory, a missing file is no error.  */
+void
+read_manifest (arena_t *arena, const char *yapadir, list_t *manifest)
+{
+  char *filename, *buf = NULL;
+  size_t buflen = 0;
+  FILE *fp;
+
+  if (asprintf (&filename, "%s/nails", yapadir) < 0)
+    yapa_oom ();
+
+  count_syscall (SYS_OPEN);
+  fp = fopen (filename, "r");
+  free (filename);
+  if (fp == NULL)
+    return;
+
+  while (!feof (fp))
+    {
+      char *cp, *ptr;
+      ssize_t n = getline (&buf, &buflen, fp);
+
+      if (n < 1)
+	break;
+
+      cp = buf;
+      n = strlen (cp) - 1;
+      if (cp[n] == '\n') /* remove trailing newline */
+	cp[n--] = '\0';
+      while (n > 0 && isspace ((int)cp[n]))
+	cp[n--] = '\0';
+
+      ptr = strrchr (cp, '@');
+      if (ptr == NULL) /* ignore broken lines */
+	continue;
+      *ptr++ = '\0';
+
+      manifest_l *entry = arena_alloc (arena, sizeof (manifest_l));
+      entry->name = arena_strdup (arena, cp);
+      entry->params = arena_strdup (arena, ptr);
+      list_append (manifest, entry);
+    }
+  free (buf);
+  fclose (fp);
+}
+
+/* Write yapa/nails of a directory. The file is replaced atomically,
+   so that an interrupted run does not lose the old entries.  */
+void
+write_manifest (const char *yapadir, list_t *manifest)
+{
+  manifest_l *entry;
+  char *filename, *tmpname;
+  FILE *fp;
+
+  if (asprintf (&filename, "%s/nails", yapadir) < 0)
+    yapa_oom ();
+
+  if (manifest->first == NULL)
+    {
+      unlink (filename);
+      free (filename);
+      return;
+    }
+
+  if (asprintf (&tmpname, "%s.new", filename) < 0)
+    yapa_oom ();
+
+  fp = fopen (tmpname, "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, _("ERROR: Cannot create %s: %m\n"), tmpname);
+      free (tmpname);
+      free (filename);
+      return;
+    }
+
+  for (entry = manifest->first; entry != NULL; entry = entry->next)
+    fprintf (fp, "%s@%s\n", entry->name, entry->params);
+
+  if (fclose (fp) != 0 || rename (tmpname, filename) != 0)
+    {
+      fprintf (stderr, _("ERROR: Cannot write %s: %m\n"), filename);
+      unlink (tmpname);
+    }
+
+  free (tmpname);
+  free (filename);
+}
+
+/* The new yapa/nails of a directory is written when update_nails and
+   all nail jobs of the directory are done. If the run gets interrupted
+   before, the old file is kept, so nails with changed parameters are
+   recreated by the next run even if they are newer than the image.
+   Failed jobs remove their nails, they get recreated as missing.  */
+manifest_t *
+create_manifest (const char *yapadir)
+{
+  manifest_t *manifest = calloc (1, sizeof (manifest_t));
+
+  if (manifest == NULL || (manifest->yapadir = strdup (yapadir)) == NULL)
+    yapa_oom ();
+  manifest->arena = arena_create ();
+  manifest->users = 1;
+  return manifest;
+}
+
+void
+hold_manifest (manifest_t *manifest)
+{
+  manifest->users++;
+}
+
+/* Write the manifest, if the last user is done.  */
+void
+release_manifest (manifest_t *manifest)
+{
+  if (--manifest->users > 0)
+    return;
+
+  if (manifest->changed)
+    write_manifest (manifest->yapadir, &manifest->entries);
+  list_clear (&manifest->entries);
+  arena_free (manifest->arena);
+  free (manifest->yapadir);
+  free (manifest);
+}
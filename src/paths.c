@@ -0,0 +1,188 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "main.h"
+
+/* The path of a directory is not copied for every image and file,
+   all entries of the directory point to one copy in the arena of the
+   directory, see scan_dir, which is freed together with them. Only
+   the paths of directory entries of their own, see new_dir, are
+   interned: every path is stored once and kept until the end of the
+   program, there are only a few of them.  */
+
+/* the scanner threads intern paths in parallel */
+static pthread_mutex_t paths_lock = PTHREAD_MUTEX_INITIALIZER;
+static hash_table_t *paths = NULL;
+
+/* Returns the interned copy of path.  */
+const char *
+intern_path (const char *path)
+{
+  const char *interned;
+
+  pthread_mutex_lock (&paths_lock);
+  if (paths == NULL)
+    paths = hash_create (1024);
+  interned = hash_intern (paths, path);
+  pthread_mutex_unlock (&paths_lock);
+
+  return interned;
+}
+
+/* The paths of files are built in a path_t instead of a new string
+   from asprintf for every file. path_get hands out a path_t of the
+   calling thread, path_put gives it back with its buffer for the next
+   caller. So after the first files no malloc is needed anymore. A
+   path_t is only valid until it is given back, the functions building
+   the path return path->str.  */
+
+static pthread_key_t unused_key;
+static pthread_once_t unused_once = PTHREAD_ONCE_INIT;
+
+static void
+free_path_list (void *ptr)
+{
+  path_t *path = ptr;
+
+  while (path != NULL)
+    {
+      path_t *next = path->next;
+
+      free (path->str);
+      free (path);
+      path = next;
+    }
+}
+
+/* the unused paths of a thread are freed when it exits */
+static void
+create_unused_key (void)
+{
+  if (pthread_key_create (&unused_key, free_path_list) != 0)
+    yapa_oom ();
+}
+
+/* Returns an empty path, which has to be given back with path_put.  */
+path_t *
+path_get (void)
+{
+  path_t *path;
+
+  pthread_once (&unused_once, create_unused_key);
+  path = pthread_getspecific (unused_key);
+  if (path != NULL)
+    pthread_setspecific (unused_key, path->next);
+  else
+    {
+      path = calloc (1, sizeof (path_t));
+      if (path == NULL)
+	yapa_oom ();
+    }
+
+  path_truncate (path, 0);
+  return path;
+}
+
+void
+path_put (path_t *path)
+{
+  path->next = pthread_getspecific (unused_key);
+  pthread_setspecific (unused_key, path);
+}
+
+/* Make room for len characters and the terminating 0.  */
+static void
+path_reserve (path_t *path, size_t len)
+{
+  size_t size = path->size ? path->size : 256;
+
+  if (len < path->size)
+    return;
+
+  while (size <= len)
+    size *= 2;
+  path->str = realloc (path->str, size);
+  if (path->str == NULL)
+    yapa_oom ();
+  path->size = size;
+}
+
+const char *
+path_truncate (path_t *path, size_t len)
+{
+  path_reserve (path, len);
+  path->len = len;
+  path->str[len] = '\0';
+  return path->str;
+}
+
+const char *
+path_set (path_t *path, const char *str)
+{
+  path_truncate (path, 0);
+  return path_append (path, str);
+}
+
+/* Append str as it is, e.g. an extension.  */
+const char *
+path_append (path_t *path, const char *str)
+{
+  size_t len = strlen (str);
+
+  path_reserve (path, path->len + len);
+  memcpy (&path->str[path->len], str, len + 1);
+  path->len += len;
+  return path->str;
+}
+
+/* Append name as new component of the path.  */
+const char *
+path_add (path_t *path, const char *name)
+{
+  path_append (path, "/");
+  return path_append (path, name);
+}
+
+/* Set path to the directory of dir.  */
+const char *
+path_dir (path_t *path, const dir_l *dir)
+{
+  path_set (path, dir->path);
+  if (dir->name == NULL) /* root directory */
+    return path->str;
+  return path_add (path, dir->name);
+}
+
+void
+free_paths (void)
+{
+  hash_free (paths, NULL);
+  paths = NULL;
+
+  /* the paths of the other threads are freed when they exit */
+  pthread_once (&unused_once, create_unused_key);
+  free_path_list (pthread_getspecific (unused_key));
+  pthread_setspecific (unused_key, NULL);
+}
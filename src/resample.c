@@ -0,0 +1,514 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "main.h"
+
+/* Separable resampling of ARGB images as used by imlib2. Every
+   image is first resampled horizontally row by row into a small
+   ring buffer of float rows, which is then resampled vertically.
+   The scalar code is the reference, the SSE2 and AVX2 variants
+   have to produce the same result (+/- 1 because of rounding),
+   tests/resample-check compares them.  */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static double
+filter_box (double x)
+{
+  if (x >= -0.5 && x < 0.5)
+    return 1.0;
+  return 0.0;
+}
+
+/* Mitchell-Netravali with B = C = 1/3 */
+static double
+filter_mitchell (double x)
+{
+  const double B = 1.0 / 3.0;
+  const double C = 1.0 / 3.0;
+
+  x = fabs (x);
+  if (x < 1.0)
+    return ((12 - 9 * B - 6 * C) * x * x * x +
+	    (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0;
+  if (x < 2.0)
+    return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+	    (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0;
+  return 0.0;
+}
+
+static double
+filter_lanczos3 (double x)
+{
+  if (x == 0.0)
+    return 1.0;
+  if (x <= -3.0 || x >= 3.0)
+    return 0.0;
+  return 3.0 * sin (M_PI * x) * sin (M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+}
+
+static const struct {
+  const char *name;
+  double support;
+  double (*func) (double x);
+} filters[] = {
+  [FILTER_LANCZOS3] = { "lanczos3", 3.0, filter_lanczos3 },
+  [FILTER_MITCHELL] = { "mitchell", 2.0, filter_mitchell },
+  [FILTER_BOX]      = { "box",      0.5, filter_box },
+};
+#define NR_FILTERS (int)(sizeof (filters) / sizeof (filters[0]))
+
+/* Return the filter for a name from yapa/config, or -1.  */
+int
+get_resample_filter (const char *name)
+{
+  int i;
+
+  for (i = 0; i < NR_FILTERS; i++)
+    if (strcasecmp (filters[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+const char *
+resample_filter_name (int filter)
+{
+  if (filter < 0 || filter >= NR_FILTERS)
+    return "unknown";
+  return filters[filter].name;
+}
+
+/* Which source pixels contribute with which weight to an output
+   pixel. Every output pixel uses the same number of taps, pixels
+   at the border get a window shifted into the image.  */
+typedef struct contrib_t {
+  unsigned int taps;    /* number of source pixels per output pixel */
+  unsigned int *start;  /* first source pixel of every output pixel */
+  float *weights;       /* taps weights for every output pixel */
+} contrib_t;
+
+static void
+calc_contrib (contrib_t *c, unsigned int src_len, unsigned int dst_len,
+	      int filter)
+{
+  double scale = (double) src_len / dst_len;
+  double fscale = scale > 1.0 ? scale : 1.0;
+  double support = filters[filter].support * fscale;
+  double window = ceil (support * 2.0);
+  unsigned int taps = (unsigned int) window + 1;
+  unsigned int i, k;
+
+  if (taps > src_len)
+    taps = src_len;
+
+  c->taps = taps;
+  c->start = malloc (dst_len * sizeof (unsigned int));
+  c->weights = malloc ((size_t) dst_len * taps * sizeof (float));
+  if (c->start == NULL || c->weights == NULL)
+    yapa_oom ();
+
+  for (i = 0; i < dst_len; i++)
+    {
+      double center = (i + 0.5) * scale;
+      double left = floor (center - support - 0.5);
+      long start = (long) left + 1;
+      float *w = &c->weights[(size_t) i * taps];
+      double sum = 0.0;
+
+      if (start + taps > src_len)
+	start = src_len - taps;
+      if (start < 0)
+	start = 0;
+      c->start[i] = start;
+
+      for (k = 0; k < taps; k++)
+	{
+	  double val = filters[filter].func ((start + k + 0.5 - center) /
+					     fscale);
+	  w[k] = val;
+	  sum += val;
+	}
+
+      if (sum != 0.0)
+	for (k = 0; k < taps; k++)
+	  w[k] /= sum;
+      else /* can only happen with box filter: use nearest pixel */
+	{
+	  long nearest = (long) center - start;
+
+	  if (nearest >= (long) taps)
+	    nearest = taps - 1;
+	  memset (w, 0, taps * sizeof (float));
+	  w[nearest] = 1.0;
+	}
+    }
+}
+
+static void
+free_contrib (contrib_t *c)
+{
+  free (c->start);
+  free (c->weights);
+}
+
+typedef void (*hresample_func) (const uint32_t *src, float *dst,
+				unsigned int dst_width, const contrib_t *c);
+typedef void (*vresample_func) (float * const *rows, const float *weights,
+				unsigned int taps, uint32_t *dst,
+				unsigned int dst_width);
+
+/* Scalar reference implementation */
+
+static void
+hresample_scalar (const uint32_t *src, float *dst, unsigned int dst_width,
+		  const contrib_t *c)
+{
+  unsigned int x, k;
+
+  for (x = 0; x < dst_width; x++)
+    {
+      const float *w = &c->weights[(size_t) x * c->taps];
+      const uint32_t *p = &src[c->start[x]];
+      float ch0 = 0, ch1 = 0, ch2 = 0, ch3 = 0;
+
+      for (k = 0; k < c->taps; k++)
+	{
+	  ch0 += w[k] * (p[k] & 0xff);
+	  ch1 += w[k] * ((p[k] >> 8) & 0xff);
+	  ch2 += w[k] * ((p[k] >> 16) & 0xff);
+	  ch3 += w[k] * (p[k] >> 24);
+	}
+      dst[4 * x] = ch0;
+      dst[4 * x + 1] = ch1;
+      dst[4 * x + 2] = ch2;
+      dst[4 * x + 3] = ch3;
+    }
+}
+
+static uint32_t
+clamp_channel (float val)
+{
+  if (val <= 0.0)
+    return 0;
+  if (val >= 255.0)
+    return 255;
+  return (uint32_t) (val + 0.5);
+}
+
+static void
+vresample_scalar (float * const *rows, const float *weights,
+		  unsigned int taps, uint32_t *dst, unsigned int dst_width)
+{
+  unsigned int x, k, ch;
+
+  for (x = 0; x < dst_width; x++)
+    {
+      uint32_t pixel = 0;
+
+      for (ch = 0; ch < 4; ch++)
+	{
+	  float sum = 0;
+
+	  for (k = 0; k < taps; k++)
+	    sum += weights[k] * rows[k][4 * x + ch];
+	  pixel |= clamp_channel (sum) << (8 * ch);
+	}
+      dst[x] = pixel;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2: one pixel with its four channels per vector */
+
+__attribute__((target ("sse2"))) static __m128
+load_pixel_sse2 (uint32_t pixel)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i px = _mm_cvtsi32_si128 ((int) pixel);
+
+  px = _mm_unpacklo_epi8 (px, zero);
+  px = _mm_unpacklo_epi16 (px, zero);
+  return _mm_cvtepi32_ps (px);
+}
+
+__attribute__((target ("sse2"))) static uint32_t
+store_pixel_sse2 (__m128 val)
+{
+  __m128i px = _mm_cvtps_epi32 (val);
+
+  /* saturation clamps every channel to 0..255 */
+  px = _mm_packs_epi32 (px, px);
+  px = _mm_packus_epi16 (px, px);
+  return (uint32_t) _mm_cvtsi128_si32 (px);
+}
+
+__attribute__((target ("sse2"))) static void
+hresample_sse2 (const uint32_t *src, float *dst, unsigned int dst_width,
+		const contrib_t *c)
+{
+  unsigned int x, k;
+
+  for (x = 0; x < dst_width; x++)
+    {
+      const float *w = &c->weights[(size_t) x * c->taps];
+      const uint32_t *p = &src[c->start[x]];
+      __m128 acc = _mm_setzero_ps ();
+
+      for (k = 0; k < c->taps; k++)
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (w[k]),
+					   load_pixel_sse2 (p[k])));
+      _mm_storeu_ps (&dst[4 * x], acc);
+    }
+}
+
+__attribute__((target ("sse2"))) static void
+vresample_sse2 (float * const *rows, const float *weights,
+		unsigned int taps, uint32_t *dst, unsigned int dst_width)
+{
+  unsigned int x, k;
+
+  for (x = 0; x < dst_width; x++)
+    {
+      __m128 acc = _mm_setzero_ps ();
+
+      for (k = 0; k < taps; k++)
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (weights[k]),
+					   _mm_loadu_ps (&rows[k][4 * x])));
+      dst[x] = store_pixel_sse2 (acc);
+    }
+}
+
+/* AVX2: two pixels per vector */
+
+__attribute__((target ("avx2"))) static void
+hresample_avx2 (const uint32_t *src, float *dst, unsigned int dst_width,
+		const contrib_t *c)
+{
+  unsigned int x, k;
+
+  for (x = 0; x < dst_width; x++)
+    {
+      const float *w = &c->weights[(size_t) x * c->taps];
+      const uint32_t *p = &src[c->start[x]];
+      __m256 acc = _mm256_setzero_ps ();
+      __m128 sum;
+
+      for (k = 0; k + 2 <= c->taps; k += 2)
+	{
+	  __m128i px = _mm_loadl_epi64 ((const __m128i *) &p[k]);
+	  __m256 val = _mm256_cvtepi32_ps (_mm256_cvtepu8_epi32 (px));
+	  __m256 wv = _mm256_insertf128_ps (_mm256_castps128_ps256
+					    (_mm_set1_ps (w[k])),
+					    _mm_set1_ps (w[k + 1]), 1);
+	  acc = _mm256_add_ps (acc, _mm256_mul_ps (wv, val));
+	}
+      sum = _mm_add_ps (_mm256_castps256_ps128 (acc),
+			_mm256_extractf128_ps (acc, 1));
+      if (k < c->taps)
+	sum = _mm_add_ps (sum, _mm_mul_ps (_mm_set1_ps (w[k]),
+					   load_pixel_sse2 (p[k])));
+      _mm_storeu_ps (&dst[4 * x], sum);
+    }
+}
+
+__attribute__((target ("avx2"))) static void
+vresample_avx2 (float * const *rows, const float *weights,
+		unsigned int taps, uint32_t *dst, unsigned int dst_width)
+{
+  unsigned int x, k;
+
+  for (x = 0; x + 2 <= dst_width; x += 2)
+    {
+      __m256 acc = _mm256_setzero_ps ();
+      __m256i px;
+      __m128i px16;
+
+      for (k = 0; k < taps; k++)
+	acc = _mm256_add_ps (acc,
+			     _mm256_mul_ps (_mm256_set1_ps (weights[k]),
+					    _mm256_loadu_ps (&rows[k][4 * x])));
+      px = _mm256_cvtps_epi32 (acc);
+      px16 = _mm_packs_epi32 (_mm256_castsi256_si128 (px),
+			      _mm256_extracti128_si256 (px, 1));
+      _mm_storel_epi64 ((__m128i *) &dst[x], _mm_packus_epi16 (px16, px16));
+    }
+
+  if (x < dst_width)
+    {
+      __m128 acc = _mm_setzero_ps ();
+
+      for (k = 0; k < taps; k++)
+	acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (weights[k]),
+					   _mm_loadu_ps (&rows[k][4 * x])));
+      dst[x] = store_pixel_sse2 (acc);
+    }
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static hresample_func hresample = NULL;
+static vresample_func vresample = NULL;
+static const char *resample_impl = NULL;
+
+/* Select the fastest implementation the CPU supports.  */
+static void
+select_impl (void)
+{
+  hresample = hresample_scalar;
+  vresample = vresample_scalar;
+  resample_impl = "scalar";
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      hresample = hresample_avx2;
+      vresample = vresample_avx2;
+      resample_impl = "avx2";
+    }
+  else if (__builtin_cpu_supports ("sse2"))
+    {
+      hresample = hresample_sse2;
+      vresample = vresample_sse2;
+      resample_impl = "sse2";
+    }
+#endif
+}
+
+/* Use the implementation with name ("scalar", "sse2" or "avx2")
+   instead of the fastest one, for the checks and benchmarks in
+   tests. Returns -1 if the CPU does not support it.  */
+int
+set_resample_impl (const char *name)
+{
+  if (strcmp (name, "scalar") == 0)
+    {
+      hresample = hresample_scalar;
+      vresample = vresample_scalar;
+      resample_impl = "scalar";
+      return 0;
+    }
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (strcmp (name, "sse2") == 0 && __builtin_cpu_supports ("sse2"))
+    {
+      hresample = hresample_sse2;
+      vresample = vresample_sse2;
+      resample_impl = "sse2";
+      return 0;
+    }
+  if (strcmp (name, "avx2") == 0 && __builtin_cpu_supports ("avx2"))
+    {
+      hresample = hresample_avx2;
+      vresample = vresample_avx2;
+      resample_impl = "avx2";
+      return 0;
+    }
+#endif
+  return -1;
+}
+
+/* Resample an ARGB image to dst_width x dst_height pixels.
+   Returns newly allocated image data.  */
+uint32_t *
+resample_image (const uint32_t *src, unsigned int src_width,
+		unsigned int src_height, unsigned int dst_width,
+		unsigned int dst_height, int filter)
+{
+  struct timespec start_time, end_time;
+  contrib_t cx, cy;
+  uint32_t *dst;
+  float *ring, **rows;
+  size_t row_len = (size_t) dst_width * 4;
+  unsigned int next_row = 0, y, k;
+
+  if (hresample == NULL)
+    select_impl ();
+
+  if (filter < 0 || filter >= NR_FILTERS)
+    filter = FILTER_LANCZOS3;
+
+  if (debug_flag)
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+
+  calc_contrib (&cx, src_width, dst_width, filter);
+  calc_contrib (&cy, src_height, dst_height, filter);
+
+  dst = malloc ((size_t) dst_width * dst_height * sizeof (uint32_t));
+  ring = malloc (cy.taps * row_len * sizeof (float));
+  rows = malloc (cy.taps * sizeof (float *));
+  if (dst == NULL || ring == NULL || rows == NULL)
+    yapa_oom ();
+
+  for (y = 0; y < dst_height; y++)
+    {
+      unsigned int first = cy.start[y];
+
+      /* resample all missing source rows horizontally, a source
+	 row is stored in the ring buffer at (row % taps).  */
+      while (next_row < first + cy.taps)
+	{
+	  hresample (&src[(size_t) next_row * src_width],
+		     &ring[(next_row % cy.taps) * row_len], dst_width, &cx);
+	  next_row++;
+	}
+
+      for (k = 0; k < cy.taps; k++)
+	rows[k] = &ring[((first + k) % cy.taps) * row_len];
+
+      vresample (rows, &cy.weights[(size_t) y * cy.taps], cy.taps,
+		 &dst[(size_t) y * dst_width], dst_width);
+    }
+
+  free (rows);
+  free (ring);
+  free_contrib (&cx);
+  free_contrib (&cy);
+
+  if (debug_flag)
+    {
+      double secs;
+
+      clock_gettime (CLOCK_MONOTONIC, &end_time);
+      secs = (end_time.tv_sec - start_time.tv_sec) +
+	(end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+      printf ("========>RESAMPLE: %ux%u -> %ux%u, %s/%s, %.2f ms, %.1f MP/s\n",
+	      src_width, src_height, dst_width, dst_height,
+	      filters[filter].name, resample_impl, secs * 1000.0,
+	      secs > 0 ? (double) src_width * src_height / secs / 1e6 : 0.0);
+    }
+
+  return dst;
+}
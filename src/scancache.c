@@ -0,0 +1,355 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "main.h"
+
+/* <root>/yapa/scancache contains the entries of every directory of
+   the album found by the last run, together with the inode and
+   modification time of the directory. As long as both don't change,
+   no file was added, removed or renamed in the directory and the
+   entries can be used instead of reading the directory again. Every
+   directory is checked on its own, so a change deep in the album only
+   causes a rescan of the changed directory. Files modified in place,
+   like html pages rewritten by yapa or edited descriptions, don't
+   change the directory, so the modification times of the files are
+   not cached, the scanner stats them. Format:
+     dir <inode> <mtime sec> <mtime nsec> <path relative to root>
+     file <name>
+     subdir <name>
+     link <name>     symlink to a directory  */
+
+#define SCAN_CACHE_HEADER "# yapa scan cache 4"
+
+int use_scan_cache = 1;
+
+/* the scanner threads access the cache in parallel */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static hash_table_t *cache = NULL;
+static arena_t *cache_names = NULL;  /* names of the loaded listings */
+static char *cache_root = NULL;
+static size_t cache_root_len;
+static int cache_changed = 0;
+
+static const char *
+cache_key (const char *directory)
+{
+  if (strncmp (directory, cache_root, cache_root_len) == 0)
+    {
+      if (directory[cache_root_len] == '\0')
+	return ".";
+      if (directory[cache_root_len] == '/')
+	return &directory[cache_root_len + 1];
+    }
+  return directory;
+}
+
+void
+add_scan_entry (scan_dir_t *listing, const char *name, int type,
+		time_t mtime)
+{
+  /* grow the array whenever count reaches a power of two */
+  if ((listing->count & (listing->count - 1)) == 0)
+    {
+      size_t size = listing->count ? listing->count * 2 : 1;
+
+      listing->entries = realloc (listing->entries,
+				  size * sizeof (scan_entry_t));
+      if (listing->entries == NULL)
+	yapa_oom ();
+    }
+
+  if (listing->names != NULL)
+    listing->entries[listing->count].name = arena_strdup (listing->names, name);
+  else if ((listing->entries[listing->count].name = strdup (name)) == NULL)
+    yapa_oom ();
+  listing->entries[listing->count].type = type;
+  listing->entries[listing->count].mtime = mtime;
+  listing->count++;
+}
+
+void
+free_scan_dir (void *ptr)
+{
+  scan_dir_t *listing = ptr;
+  size_t i;
+
+  if (listing->names == NULL)
+    for (i = 0; i < listing->count; i++)
+      free (listing->entries[i].name);
+  free (listing->entries);
+  free (listing);
+}
+
+void
+load_scan_cache (const char *root_path)
+{
+  scan_dir_t *listing = NULL;
+  char *filename, *buf = NULL;
+  size_t buflen = 0;
+  FILE *fp;
+
+  if (cache != NULL)
+    free_scan_cache ();
+
+  cache_root = strdup (root_path);
+  if (cache_root == NULL)
+    yapa_oom ();
+  cache_root_len = strlen (cache_root);
+  cache = hash_create (1024);
+  cache_names = arena_create ();
+
+  if (!use_scan_cache)
+    return;
+
+  if (asprintf (&filename, "%s/yapa/scancache", root_path) < 0)
+    yapa_oom ();
+  count_syscall (SYS_OPEN);
+  fp = fopen (filename, "r");
+  free (filename);
+  if (fp == NULL)
+    return;
+
+  if (getline (&buf, &buflen, fp) < 1 ||
+      strcmp (buf, SCAN_CACHE_HEADER "\n") != 0)
+    {
+      /* written by another version, start again */
+      free (buf);
+      fclose (fp);
+      return;
+    }
+
+  while (1)
+    {
+      ssize_t n = getline (&buf, &buflen, fp);
+      unsigned long long ino;
+      long long sec;
+      long nsec;
+      int pos;
+
+      if (n < 1)
+	break;
+      if (buf[n - 1] == '\n')
+	buf[n - 1] = '\0';
+
+      if (sscanf (buf, "dir %llu %lld %ld %n", &ino, &sec, &nsec, &pos) == 3)
+	{
+	  listing = calloc (1, sizeof (scan_dir_t));
+	  if (listing == NULL)
+	    yapa_oom ();
+	  listing->names = cache_names;
+	  listing->ino = ino;
+	  listing->mtime.tv_sec = sec;
+	  listing->mtime.tv_nsec = nsec;
+	  listing = hash_insert (cache, &buf[pos], listing);
+	  /* a directory is only listed once */
+	  if (listing != NULL)
+	    free_scan_dir (listing);
+	  listing = hash_lookup (cache, &buf[pos]);
+	}
+      else if (listing == NULL)
+	continue;
+      else if (strncmp (buf, "file ", 5) == 0)
+	add_scan_entry (listing, &buf[5], DT_REG, 0);
+      else if (strncmp (buf, "subdir ", 7) == 0)
+	add_scan_entry (listing, &buf[7], DT_DIR, 0);
+      else if (strncmp (buf, "link ", 5) == 0)
+	add_scan_entry (listing, &buf[5], DT_LNK, 0);
+    }
+
+  free (buf);
+  fclose (fp);
+}
+
+/* Returns the cached entries of a directory, if it was not modified
+   since they were recorded, else NULL.  */
+scan_dir_t *
+lookup_scan_cache (const char *directory, unsigned long long ino,
+		   const struct timespec *mtime)
+{
+  scan_dir_t *listing;
+
+  pthread_mutex_lock (&cache_lock);
+  listing = hash_lookup (cache, cache_key (directory));
+  if (listing != NULL &&
+      (listing->ino != ino || listing->mtime.tv_sec != mtime->tv_sec ||
+       listing->mtime.tv_nsec != mtime->tv_nsec))
+    listing = NULL;
+  if (listing != NULL)
+    listing->seen = 1;
+  pthread_mutex_unlock (&cache_lock);
+
+  return listing;
+}
+
+/* Record the entries of a directory, the cache takes ownership of
+   listing.  */
+void
+store_scan_cache (const char *directory, scan_dir_t *listing)
+{
+  size_t i;
+
+  /* --stream keeps no cache in memory */
+  if (cache == NULL)
+    {
+      free_scan_dir (listing);
+      return;
+    }
+
+  /* A directory modified in the same second as it was read could
+     have been changed after reading it without a new mtime on
+     filesystems with a granularity of seconds.  */
+  if (listing->mtime.tv_sec >= time (NULL) - 1 ||
+      strchr (directory, '\n') != NULL)
+    {
+      free_scan_dir (listing);
+      return;
+    }
+  for (i = 0; i < listing->count; i++)
+    if (strchr (listing->entries[i].name, '\n') != NULL)
+      {
+	free_scan_dir (listing);
+	return;
+      }
+
+  listing->seen = 1;
+
+  pthread_mutex_lock (&cache_lock);
+  listing = hash_insert (cache, cache_key (directory), listing);
+  cache_changed = 1;
+  pthread_mutex_unlock (&cache_lock);
+
+  if (listing != NULL)
+    free_scan_dir (listing);
+}
+
+static void
+count_unseen (const char *key __attribute__((unused)), void *value,
+	      void *data)
+{
+  scan_dir_t *listing = value;
+
+  if (!listing->seen)
+    ++*(int *)data;
+}
+
+static void
+mark_seen (const char *key __attribute__((unused)), void *value,
+	   void *data __attribute__((unused)))
+{
+  scan_dir_t *listing = value;
+
+  listing->seen = 1;
+}
+
+static void
+write_listing (const char *key, void *value, void *data)
+{
+  scan_dir_t *listing = value;
+  FILE *fp = data;
+  size_t i;
+
+  if (!listing->seen)
+    return;
+
+  fprintf (fp, "dir %llu %lld %ld %s\n", listing->ino,
+	   (long long) listing->mtime.tv_sec, (long) listing->mtime.tv_nsec,
+	   key);
+  for (i = 0; i < listing->count; i++)
+    {
+      if (listing->entries[i].type == DT_DIR)
+	fprintf (fp, "subdir %s\n", listing->entries[i].name);
+      else if (listing->entries[i].type == DT_LNK)
+	fprintf (fp, "link %s\n", listing->entries[i].name);
+      else
+	fprintf (fp, "file %s\n", listing->entries[i].name);
+    }
+}
+
+/* Write the cache, if anything changed since it was loaded or
+   written the last time. If complete is set, the whole album was
+   scanned and directories not seen don't exist anymore.  */
+void
+save_scan_cache (int complete)
+{
+  char *filename, *tmpname;
+  int unseen = 0;
+  FILE *fp = NULL;
+  int fd;
+
+  if (cache == NULL)
+    return;
+
+  if (complete)
+    hash_foreach (cache, count_unseen, &unseen);
+  else
+    hash_foreach (cache, mark_seen, NULL);
+  if (!cache_changed && unseen == 0)
+    return;
+
+  if (asprintf (&filename, "%s/yapa/scancache", cache_root) < 0 ||
+      asprintf (&tmpname, "%s.XXXXXX", filename) < 0)
+    yapa_oom ();
+
+  /* other yapa processes could write the cache at the same time */
+  fd = mkstemp (tmpname);
+  if (fd < 0 || fchmod (fd, 0644) != 0 || (fp = fdopen (fd, "w")) == NULL)
+    {
+      fprintf (stderr, _("ERROR: Cannot create %s: %m\n"), tmpname);
+      if (fd >= 0)
+	{
+	  close (fd);
+	  unlink (tmpname);
+	}
+    }
+  else
+    {
+      fprintf (fp, "%s\n", SCAN_CACHE_HEADER);
+      hash_foreach (cache, write_listing, fp);
+      if (fclose (fp) != 0 || rename (tmpname, filename) != 0)
+	{
+	  fprintf (stderr, _("ERROR: Cannot write %s: %m\n"), filename);
+	  unlink (tmpname);
+	}
+      else
+	cache_changed = 0;
+    }
+
+  free (tmpname);
+  free (filename);
+}
+
+void
+free_scan_cache (void)
+{
+  hash_free (cache, free_scan_dir);
+  cache = NULL;
+  arena_free (cache_names);
+  cache_names = NULL;
+  free (cache_root);
+  cache_root = NULL;
+  cache_changed = 0;
+}
@@ -0,0 +1,1042 @@
+/* Copyright (c) 2006, 2007, 2008, 2009, 2018, 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "main.h"
+
+/* Scanning the album is dominated by the latency of the filesystem,
+   so the directories are scanned by a pool of threads. Every thread
+   has its own queue of directories, new subdirectories are added to
+   it and taken from the end again, idle threads steal from the front
+   of the queues of the other threads, where the directories nearest
+   to the root are.
+   Only the thread scanning a directory modifies its entry in the
+   dir_l tree, the subdirectories are added in readdir order like
+   before. Empty directories are removed afterwards in a single
+   thread, so the tree does not depend on the number of threads.  */
+
+/* the path of the directory is built from dir, see path_dir */
+typedef struct scan_task_t {
+  dir_l *dir;
+} scan_task_t;
+
+typedef struct worker_t {
+  pthread_mutex_t lock;
+  scan_task_t *tasks;       /* queued directories are tasks[head..tail-1] */
+  size_t head;
+  size_t tail;
+  size_t size;
+  int id;
+  pthread_t thread;
+} worker_t;
+
+static worker_t *workers;
+static int nr_workers;
+
+/* pool_lock protects pending and nr_idle, tasks are only queued with
+   it held, so that idle threads cannot miss new work.  */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long pending = 0; /* queued or running tasks */
+static int nr_idle = 0;
+
+/* Symlinks can make a directory part of the album several times or
+   create loops. Every scanned directory is recorded with device and
+   inode in visited, a directory found again is not scanned a second
+   time but marked as shallow, its pages are the ones of the first
+   entry. Symlinked directories are collected in links and scanned
+   after all other directories, so that a directory is scanned at its
+   real place.  */
+static pthread_mutex_t visited_lock = PTHREAD_MUTEX_INITIALIZER;
+static hash_table_t *visited = NULL;
+static scan_task_t *links = NULL;
+static size_t nr_links = 0;
+
+static void
+push_task (worker_t *w, dir_l *dir)
+{
+  pthread_mutex_lock (&pool_lock);
+  pending++;
+
+  pthread_mutex_lock (&w->lock);
+  if (w->tail == w->size)
+    {
+      if (w->head > 0)
+	{
+	  memmove (w->tasks, &w->tasks[w->head],
+		   (w->tail - w->head) * sizeof (scan_task_t));
+	  w->tail -= w->head;
+	  w->head = 0;
+	}
+      else
+	{
+	  w->size = w->size ? w->size * 2 : 64;
+	  w->tasks = realloc (w->tasks, w->size * sizeof (scan_task_t));
+	  if (w->tasks == NULL)
+	    yapa_oom ();
+	}
+    }
+  w->tasks[w->tail].dir = dir;
+  w->tail++;
+  pthread_mutex_unlock (&w->lock);
+
+  if (nr_idle > 0)
+    pthread_cond_signal (&pool_cond);
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Take the newest task of the own queue.  */
+static int
+pop_task (worker_t *w, scan_task_t *task)
+{
+  int found = 0;
+
+  pthread_mutex_lock (&w->lock);
+  if (w->tail > w->head)
+    {
+      *task = w->tasks[--w->tail];
+      if (w->tail == w->head)
+	w->head = w->tail = 0;
+      found = 1;
+    }
+  pthread_mutex_unlock (&w->lock);
+
+  return found;
+}
+
+/* Take the oldest task of the queue of another thread.  */
+static int
+steal_task (worker_t *w, scan_task_t *task)
+{
+  int i;
+
+  for (i = 1; i < nr_workers; i++)
+    {
+      worker_t *victim = &workers[(w->id + i) % nr_workers];
+      int found = 0;
+
+      pthread_mutex_lock (&victim->lock);
+      if (victim->tail > victim->head)
+	{
+	  *task = victim->tasks[victim->head++];
+	  if (victim->tail == victim->head)
+	    victim->head = victim->tail = 0;
+	  found = 1;
+	}
+      pthread_mutex_unlock (&victim->lock);
+
+      if (found)
+	return 1;
+    }
+  return 0;
+}
+
+/* Returns 0 if all directories are scanned.  */
+static int
+get_task (worker_t *w, scan_task_t *task)
+{
+  int found = 0;
+
+  if (pop_task (w, task) || steal_task (w, task))
+    return 1;
+
+  pthread_mutex_lock (&pool_lock);
+  while (pending > 0)
+    {
+      if (pop_task (w, task) || steal_task (w, task))
+	{
+	  found = 1;
+	  break;
+	}
+      nr_idle++;
+      pthread_cond_wait (&pool_cond, &pool_lock);
+      nr_idle--;
+    }
+  pthread_mutex_unlock (&pool_lock);
+
+  return found;
+}
+
+static void
+task_done (void)
+{
+  pthread_mutex_lock (&pool_lock);
+  if (--pending == 0)
+    pthread_cond_broadcast (&pool_cond);
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Returns 1 if the directory was not seen before.  */
+static int
+mark_visited (unsigned long long dev, unsigned long long ino)
+{
+  char key[64];
+  int ret = 1;
+
+  if (visited == NULL)
+    return 1;
+
+  snprintf (key, sizeof (key), "%llx:%llx", dev, ino);
+  pthread_mutex_lock (&visited_lock);
+  if (hash_lookup (visited, key) != NULL)
+    ret = 0;
+  else
+    hash_insert (visited, key, visited);
+  pthread_mutex_unlock (&visited_lock);
+
+  return ret;
+}
+
+static void
+add_link (dir_l *dir)
+{
+  pthread_mutex_lock (&visited_lock);
+  /* grow the array whenever nr_links reaches a power of two */
+  if ((nr_links & (nr_links - 1)) == 0)
+    {
+      links = realloc (links, (nr_links ? nr_links * 2 : 1) *
+		       sizeof (scan_task_t));
+      if (links == NULL)
+	yapa_oom ();
+    }
+  links[nr_links].dir = dir;
+  nr_links++;
+  pthread_mutex_unlock (&visited_lock);
+}
+
+static int
+has_suffix (const char *name, const char *suffix)
+{
+  size_t len = strlen (name), slen = strlen (suffix);
+
+  return len >= slen && strcasecmp (&name[len - slen], suffix) == 0;
+}
+
+/* Import the images listed in yapa/links of a directory, whose path
+   is part of the arena of dirs.  */
+static void
+read_links (const char *directory, dir_l *dirs)
+{
+  path_t *path = path_get ();
+  struct stat st;
+  FILE *fp;
+
+  path_set (path, directory);
+  path_add (path, "yapa");
+  path_add (path, "links");
+
+  /* open file with links to other images outside this directory */
+  count_syscall (SYS_OPEN);
+  fp = fopen (path->str, "r");
+  if (fp == NULL)
+    {
+      path_put (path);
+      return;
+    }
+
+  char *buf = NULL;
+  size_t buflen = 0;
+
+  if (!debug_flag)
+    printf (_("Import data from %s/yapa/links\n"), directory);
+
+  while (!feof (fp))
+    {
+      char *cp;
+      ssize_t n = getline (&buf, &buflen, fp);
+
+      cp = buf;
+
+      if (n < 1)
+	break;
+
+      while (isspace ((int)*cp))    /* remove spaces and tabs */
+	++cp;
+      if (*cp == '\0')        /* ignore empty lines */
+	continue;
+
+      n = strlen (cp) - 1;
+      if (cp[n] == '\n') /* remove trailing newline */
+	cp[n--] = '\0';
+      while (n > 0 && isspace ((int)cp[n]))
+	cp[n--] = '\0';
+
+
+      path_set (path, directory);
+      path_add (path, cp);
+
+      count_syscall (SYS_STAT);
+      if (stat (path->str, &st) == 0)
+	{
+	  if ((strcasecmp (&cp[strlen (cp) - 4],
+			   ".jpg") == 0) ||
+	      (strcasecmp (&cp[strlen (cp) - 4],
+			   ".png") == 0))
+	    {
+	      const char *srcdir;
+	      char *newname;
+
+	      newname = strrchr (cp, '/');
+	      if (newname == NULL)
+		{
+		  newname = cp;
+		  srcdir = directory;
+		}
+	      else
+		{
+		  *newname++ = '\0';
+
+		  path_set (path, directory);
+		  srcdir = arena_strdup (dir_arena (dirs),
+					 path_add (path, cp));
+		}
+
+	      if (debug_flag)
+		printf ("==> ");
+
+	      add_image (dirs, srcdir, directory, newname, st.st_mtime);
+	    }
+	  else
+	    if (debug_flag)
+	      printf ("==> ignored\n");
+	}
+      else
+	fprintf (stderr, "WARNING: file %s not found, ignoring\n", cp);
+    }
+
+  free (buf);
+  fclose (fp);
+  path_put (path);
+
+  if (!debug_flag)
+    printf (_("Finished importing data from links\n"));
+}
+
+/* Files of a directory, which are used.  */
+static int
+keep_file (const char *name)
+{
+  return has_suffix (name, ".jpg") || has_suffix (name, ".png") ||
+    has_suffix (name, ".txt") || has_suffix (name, ".gpx") ||
+    strcmp (name, ".yapaignore") == 0 ||
+    /* ignore index-*.html files */
+    /* XXX yes, this means we will not delete index-*.html files */
+    (has_suffix (name, ".html") && strncmp (name, "index-", 6) != 0);
+}
+
+/* Read the subdirectories and used files of a directory.  */
+static int
+read_listing (const char *directory, scan_dir_t *listing)
+{
+  DIR *dir = open_dir (directory);
+  struct dirent *d;
+  int fd;
+
+  if (dir == NULL)
+    return -1;
+  fd = dirfd (dir);
+
+  while ((d = read_dir (dir)) != NULL)
+    {
+      time_t mtime;
+      int type;
+
+      if (d->d_name[0] == '.' && strcmp (d->d_name, ".yapaignore") != 0)
+	{
+	  if (debug_flag)
+	    printf ("FOUND: %s ==> ignored\n", d->d_name);
+	  continue;
+	}
+
+      type = get_entry_type (fd, d);
+      if (type == DT_DIR || type == DT_LNK)
+	add_scan_entry (listing, d->d_name, type, 0);
+      else if (type == DT_REG && keep_file (d->d_name))
+	{
+	  /* only files we keep need the modification time */
+	  if (stat_entry (fd, d->d_name, NULL, &mtime) == 0)
+	    add_scan_entry (listing, d->d_name, DT_REG, mtime);
+	  else if (debug_flag)
+	    printf ("FOUND: %s ==> vanished\n", d->d_name);
+	}
+      else if (debug_flag)
+	printf ("FOUND: %s ==> ignored\n", d->d_name);
+    }
+
+  closedir (dir);
+  return 0;
+}
+
+/* Create the list of images of one directory. Subdirectories are
+   added to dirs->subdirs and queued for scanning, if w is not NULL.
+   If use_cache is not set, the directory is always read.  */
+static int
+scan_dir (worker_t *w, const char *directory, dir_l *dirs, int use_cache)
+{
+  scan_dir_t *listing = NULL;
+  unsigned long long dev, ino;
+  struct timespec mtime;
+  dir_l *subdir;
+  int cacheable, cached = 0, fd = -1;
+  size_t i;
+
+  /* stat before reading, so that changes while reading the
+     directory are detected by the next run */
+  cacheable = (stat_dir (directory, &dev, &ino, &mtime) == 0);
+  if (cacheable && !mark_visited (dev, ino))
+    {
+      if (debug_flag)
+	printf ("ALREADY SCANNED: %s\n", directory);
+      dirs->shallow = 1;
+      return 0;
+    }
+  if (cacheable && use_cache && use_scan_cache)
+    listing = lookup_scan_cache (directory, ino, &mtime);
+
+  if (listing != NULL)
+    {
+      /* for the modification times of the files */
+      count_syscall (SYS_OPEN);
+      fd = open (directory, O_RDONLY | O_DIRECTORY);
+      if (fd < 0)
+	return 1;
+      cached = 1;
+      if (debug_flag)
+	printf ("CACHED DIRECTORY: %s\n", directory);
+    }
+  else
+    {
+      listing = calloc (1, sizeof (scan_dir_t));
+      if (listing == NULL)
+	yapa_oom ();
+      listing->ino = ino;
+      listing->mtime = mtime;
+
+      if (read_listing (directory, listing) != 0)
+	{
+	  free_scan_dir (listing);
+	  return 1;
+	}
+    }
+
+  if (!debug_flag)
+    printf (_("Import data from %s\n"), directory);
+
+  /* all entries of the directory share one copy of the path, which
+     is freed with them, so memory does not grow with the album for
+     --stream and --watch */
+  directory = arena_strdup (dir_arena (dirs), directory);
+  read_links (directory, dirs);
+
+  /* the patterns are needed before the first entry is checked */
+  for (i = 0; i < listing->count; i++)
+    if (listing->entries[i].type != DT_DIR &&
+	strcmp (listing->entries[i].name, ".yapaignore") == 0)
+      {
+	dirs->ignore = load_ignore_file (directory, dirs->ignore);
+	dirs->own_ignore = (dirs->ignore != NULL &&
+			    strcmp (dirs->ignore->directory, directory) == 0);
+      }
+
+  for (i = 0; i < listing->count; i++)
+    {
+      const char *name = listing->entries[i].name;
+      time_t file_mtime = listing->entries[i].mtime;
+
+      if (debug_flag)
+	printf ("FOUND: %s ", name);
+
+      if (name[0] == '.' ||
+	  is_ignored (dirs->ignore, directory, name,
+		      listing->entries[i].type == DT_DIR))
+	{
+	  if (debug_flag)
+	    printf ("==> ignored\n");
+	}
+      else if (listing->entries[i].type == DT_LNK &&
+	       dirs->config.follow_symlinks == FOLLOW_NEVER)
+	{
+	  if (debug_flag)
+	    printf ("==> ignored symlink\n");
+	}
+      else if (listing->entries[i].type != DT_REG)
+	{
+	  if (strcmp (name, "yapa") == 0)
+	    {
+	      if (debug_flag)
+		printf ("==> ignored\n");
+	      dirs->has_meta_data = 1;
+	    }
+	  else if (strcmp (name, "picfolio") == 0)
+	    {
+	      if (debug_flag)
+		printf ("==> ignored\n");
+	    }
+	  else if (strcmp (name, "GPXViewer") == 0)
+	    {
+	      if (debug_flag)
+		printf ("==> ignored\n");
+	    }
+	  else
+	    {
+	      if (debug_flag)
+		printf ("==> Go through Subdirectory\n");
+
+	      subdir = add_dir (dirs, directory, name);
+	      subdir->ignore = dirs->ignore;
+	      subdir->symlink = (listing->entries[i].type == DT_LNK);
+	      subdir->config = get_config (subdir, dirs);
+	    }
+	}
+      else if (cached && stat_entry (fd, name, NULL, &file_mtime) != 0)
+	{
+	  if (debug_flag)
+	    printf ("==> vanished\n");
+	}
+      else if (has_suffix (name, ".jpg") || has_suffix (name, ".png"))
+	{
+	  if (debug_flag)
+	    printf ("==> ");
+	  add_image (dirs, directory, directory, name, file_mtime);
+	}
+      else if (has_suffix (name, ".html"))
+	{
+	  if (debug_flag)
+	    printf ("==> ");
+	  add_html (dirs, directory, name, file_mtime);
+	}
+      else if (has_suffix (name, ".txt"))
+	{
+	  if (debug_flag)
+	    printf ("==> ");
+	  add_txt (dirs, directory, name, file_mtime);
+	}
+      else if (has_suffix (name, ".gpx"))
+	{
+	  if (debug_flag)
+	    printf ("==> ");
+	  add_gpx (dirs, directory, name, file_mtime);
+	}
+      else if (debug_flag)
+	printf ("==> ignored\n");
+    }
+
+  /* a cached listing belongs to the cache */
+  if (cached)
+    close (fd);
+  else
+    {
+      if (cacheable)
+	store_scan_cache (directory, listing);
+      else
+	free_scan_dir (listing);
+    }
+
+  /* without worker only this directory is scanned */
+  if (w == NULL)
+    return 0;
+
+  /* Queue the subdirectories in reverse order, the own queue is
+     processed from the end, so a single thread scans them in readdir
+     order. */
+  for (subdir = dirs->subdirs.last; subdir != NULL; subdir = subdir->prev)
+    {
+      if (subdir->symlink)
+	add_link (subdir);
+      else
+	push_task (w, subdir);
+    }
+
+  return 0;
+}
+
+static void *
+scan_worker (void *arg)
+{
+  worker_t *w = arg;
+  path_t *path = path_get ();
+  scan_task_t task;
+
+  while (get_task (w, &task))
+    {
+      scan_dir (w, path_dir (path, task.dir), task.dir, 1);
+      task_done ();
+    }
+
+  path_put (path);
+  return NULL;
+}
+
+/* Remove an empty subdirectory from the list of its parent.  */
+static void
+remove_subdir (dir_l *dirs, dir_l *subdir)
+{
+  list_unlink (&dirs->subdirs, subdir);
+  free_dir (subdir);
+}
+
+/* Create the yapa directories of a directory with content.  */
+static void
+create_yapa_dirs (const char *directory, dir_l *dirs)
+{
+  if (dirs->has_meta_data == 0 &&
+      (dirs->subdirs.first != NULL || dirs->images.first != NULL))
+    {
+      path_t *path = path_get ();
+      size_t len;
+
+      path_set (path, directory);
+      mkdir (path_add (path, "yapa"), 0755);
+      len = path->len;
+      if (dirs->images.first)
+	{
+	  mkdir (path_add (path, "midnails"), 0755);
+	  path_truncate (path, len);
+	  mkdir (path_add (path, "thumbnails"), 0755);
+	}
+      path_put (path);
+    }
+}
+
+/* Remove empty directories and create the yapa directories. Runs
+   after the scan, when the content of all subdirectories is known,
+   so the subdirectories are finished before their parent.  */
+static void
+finish_dir (const char *directory, dir_l *dirs)
+{
+  dir_l *subdir = dirs->subdirs.first;
+  path_t *path = path_get ();
+
+  while (subdir != NULL)
+    {
+      dir_l *parent, *next;
+
+      /* the first directory without subdirectories */
+      while (subdir->subdirs.first != NULL)
+	subdir = subdir->subdirs.first;
+
+      /* finish it and all parents, for which it was the last one */
+      do
+	{
+	  parent = subdir->parentdir;
+	  next = subdir->next;
+	  create_yapa_dirs (path_dir (path, subdir), subdir);
+
+	  /* Directory is empty, so don't add it */
+	  if (subdir->images.first == NULL && subdir->subdirs.first == NULL &&
+	      !subdir->shallow)
+	    remove_subdir (parent, subdir);
+	  subdir = parent;
+	}
+      while (next == NULL && subdir != dirs);
+
+      subdir = next;
+    }
+  path_put (path);
+
+  create_yapa_dirs (directory, dirs);
+}
+
+
+/* Run the queued tasks with all workers.  */
+static void
+run_pool (void)
+{
+  int i;
+
+  for (i = 1; i < nr_workers; i++)
+    {
+      int err = pthread_create (&workers[i].thread, NULL, scan_worker,
+				&workers[i]);
+      if (err != 0)
+	{
+	  fprintf (stderr, "WARNING: cannot create scan thread: %s\n",
+		   strerror (err));
+	  break;
+	}
+    }
+
+  /* the main thread is the first worker */
+  scan_worker (&workers[0]);
+
+  while (--i > 0)
+    pthread_join (workers[i].thread, NULL);
+}
+
+static int
+is_within_root (const char *directory, const dir_l *dir)
+{
+  char *real = realpath (directory, NULL);
+  size_t len;
+  int ret;
+
+  if (real == NULL)
+    return 0;
+
+  while (dir->parentdir != NULL)
+    dir = dir->parentdir;
+  len = strlen (dir->path);
+  ret = (strncmp (real, dir->path, len) == 0 &&
+	 (real[len] == '/' || real[len] == '\0'));
+  free (real);
+
+  return ret;
+}
+
+static int
+cmp_links (const void *p1, const void *p2)
+{
+  path_t *path1 = path_get (), *path2 = path_get ();
+  int ret;
+
+  ret = strcmp (path_dir (path1, ((const scan_task_t *) p1)->dir),
+		path_dir (path2, ((const scan_task_t *) p2)->dir));
+  path_put (path2);
+  path_put (path1);
+
+  return ret;
+}
+
+/* Queue the symlinked directories found so far, sorted by path so
+   that the same one is scanned first every time. Returns the number
+   of queued directories.  */
+static size_t
+queue_links (void)
+{
+  scan_task_t *list = links;
+  size_t i, count = nr_links, queued = 0;
+  path_t *path;
+
+  links = NULL;
+  nr_links = 0;
+  if (count == 0)
+    return 0;
+  qsort (list, count, sizeof (scan_task_t), cmp_links);
+
+  path = path_get ();
+  for (i = 0; i < count; i++)
+    {
+      dir_l *dir = list[i].dir;
+
+      if (dir->parentdir->config.follow_symlinks == FOLLOW_WITHIN_ROOT &&
+	  !is_within_root (path_dir (path, dir), dir))
+	{
+	  if (debug_flag)
+	    printf ("SYMLINK OUTSIDE OF ALBUM: %s\n", path->str);
+	  remove_subdir (dir->parentdir, dir);
+	}
+      else
+	{
+	  push_task (&workers[0], dir);
+	  queued++;
+	}
+    }
+  path_put (path);
+  free (list);
+
+  return queued;
+}
+
+/* Go recursive through all directories and create the list of
+   images in every directory. The directories are scanned with up to
+   max_jobs threads, in debug mode with only one to keep the output
+   readable. Returns 0 on success, 1 if the root directory could not
+   be read.  */
+int
+scan_directories (const char *root_path, dir_l *rootdir)
+{
+  int i, ret = 0;
+
+  nr_workers = debug_flag ? 1 : max_jobs;
+  if (nr_workers < 1)
+    nr_workers = 1;
+
+  workers = calloc (nr_workers, sizeof (worker_t));
+  if (workers == NULL)
+    yapa_oom ();
+  for (i = 0; i < nr_workers; i++)
+    {
+      pthread_mutex_init (&workers[i].lock, NULL);
+      workers[i].id = i;
+    }
+  visited = hash_create (1024);
+
+  /* the root directory is scanned first, without it there is
+     nothing to do. It is always read, for --watch it is the
+     directory with the changes. */
+  if (scan_dir (&workers[0], root_path, rootdir, 0) != 0)
+    ret = 1;
+  else
+    do
+      run_pool ();
+    while (queue_links () > 0);
+
+  for (i = 0; i < nr_workers; i++)
+    {
+      pthread_mutex_destroy (&workers[i].lock);
+      free (workers[i].tasks);
+    }
+  free (workers);
+  workers = NULL;
+  hash_free (visited, NULL);
+  visited = NULL;
+
+  if (ret == 0)
+    finish_dir (root_path, rootdir);
+
+  return ret;
+}
+
+/* A directory with images or subdirectories got a yapa directory by
+   an earlier run.  */
+static int
+has_yapa_dir (const char *directory, const char *name)
+{
+  path_t *path = path_get ();
+  struct stat st;
+  int ret;
+
+  path_set (path, directory);
+  path_add (path, name);
+  count_syscall (SYS_STAT);
+  ret = (stat (path_add (path, "yapa"), &st) == 0 && S_ISDIR (st.st_mode));
+  path_put (path);
+
+  return ret;
+}
+
+/* Scan only the subtree target of the album. Of every directory
+   between root and target only the directory itself is read, to get
+   the configuration and the entries for the index pages. The other
+   subdirectories of these are not scanned, they are marked as
+   shallow, if an earlier run found content in them, else removed.
+   Returns 0 on success, 1 on errors.  */
+int
+scan_subtree (const char *root_path, dir_l *rootdir, const char *target)
+{
+  size_t root_len = strlen (root_path);
+  const char *cp = &target[root_len];
+  dir_l *dirs = rootdir;
+  path_t *path;
+  int ret = 0;
+
+  if (strncmp (target, root_path, root_len) != 0 || *cp != '/')
+    {
+      fprintf (stderr, _("ERROR: %s is not part of the album %s\n"),
+	       target, root_path);
+      return 1;
+    }
+
+  path = path_get ();
+  path_set (path, root_path);
+
+  while (*cp == '/')
+    {
+      const char *name = cp + 1;
+      size_t len = strcspn (name, "/");
+      dir_l *subdir, *next, *found = NULL;
+
+      cp = name + len;
+      if (len == 0)
+	continue;
+
+      if (scan_dir (NULL, path->str, dirs, 1) != 0)
+	{
+	  path_put (path);
+	  return 1;
+	}
+      dirs->ancestor = 1;
+
+      for (subdir = dirs->subdirs.first; subdir != NULL; subdir = next)
+	{
+	  next = subdir->next;
+	  if (strlen (subdir->name) == len &&
+	      strncmp (subdir->name, name, len) == 0)
+	    found = subdir;
+	  else if (has_yapa_dir (path->str, subdir->name))
+	    subdir->shallow = 1;
+	  else
+	    remove_subdir (dirs, subdir);
+	}
+
+      if (found == NULL)
+	{
+	  fprintf (stderr, _("ERROR: %s is not part of the album %s\n"),
+		   target, root_path);
+	  path_put (path);
+	  return 1;
+	}
+
+      path_add (path, found->name);
+      dirs = found;
+    }
+
+  ret = scan_directories (path->str, dirs);
+  path_put (path);
+  if (ret != 0)
+    return 1;
+
+  /* the index of the parent should not list it anymore */
+  if (dirs->images.first == NULL && dirs->subdirs.first == NULL)
+    remove_subdir (dirs->parentdir, dirs);
+
+  return 0;
+}
+
+/* Read a directory for stream_dir. Returns 1 if its content is not
+   streamed, because it could not be read or was reached twice.  */
+static int
+stream_scan (const char *directory, dir_l *dirs)
+{
+  set_stats_phase (PHASE_SCAN);
+  if (scan_dir (NULL, directory, dirs, 1) != 0 || dirs->shallow)
+    return 1;
+
+  /* the pages below need the labels of the subdirectories */
+  read_directory_labels (dirs);
+  return 0;
+}
+
+/* Returns the next subdirectory of dirs starting with subdir, which
+   has to be streamed.  */
+static dir_l *
+next_stream_subdir (dir_l *dirs, dir_l *subdir)
+{
+  path_t *path = path_get ();
+
+  while (subdir != NULL)
+    {
+      dir_l *next = subdir->next;
+
+      if (!subdir->symlink)
+	break;
+
+      /* the directory is scanned at its real place in the album */
+      if (is_within_root (path_dir (path, subdir), subdir))
+	subdir->shallow = 1;
+      else if (dirs->config.follow_symlinks == FOLLOW_WITHIN_ROOT)
+	remove_subdir (dirs, subdir);
+      else
+	break;
+      subdir = next;
+    }
+  path_put (path);
+
+  return subdir;
+}
+
+/* A subdirectory is streamed, only the entry for the index of the
+   parent is kept, marked as shallow. Returns the next subdirectory
+   to stream.  */
+static dir_l *
+stream_release (dir_l *dirs, dir_l *subdir)
+{
+  dir_l *next = subdir->next;
+
+  if (subdir->images.first == NULL && subdir->subdirs.first == NULL &&
+      !subdir->shallow)
+    remove_subdir (dirs, subdir);
+  else
+    {
+      free_dir_content (subdir);
+      subdir->shallow = 1;
+    }
+
+  return next_stream_subdir (dirs, next);
+}
+
+/* Scan, update and free one directory after the other, depth first.
+   A directory is updated after all its subdirectories, the way back
+   up follows parentdir. Returns 1 if the directory could not be read,
+   else 0.  */
+static int
+stream_dir (const char *directory, dir_l *top)
+{
+  dir_l *dirs = top, *subdir;
+  path_t *path;
+
+  set_stats_phase (PHASE_SCAN);
+  if (scan_dir (NULL, directory, top, 1) != 0)
+    return 1;
+  if (top->shallow)
+    return 0;
+  read_directory_labels (top);
+
+  path = path_get ();
+  subdir = next_stream_subdir (top, top->subdirs.first);
+  while (1)
+    {
+      /* go down to the first directory without subdirectories */
+      while (subdir != NULL)
+	{
+	  if (stream_scan (path_dir (path, subdir), subdir) == 0)
+	    {
+	      dirs = subdir;
+	      subdir = next_stream_subdir (dirs, dirs->subdirs.first);
+	    }
+	  else
+	    subdir = stream_release (dirs, subdir);
+	}
+
+      /* all subdirectories of dirs are done */
+      if (dirs->images.first != NULL || dirs->subdirs.first != NULL)
+	{
+	  create_yapa_dirs (dirs == top ? directory : path_dir (path, dirs),
+			    dirs);
+	  set_stats_phase (PHASE_HTML);
+	  update_directory (dirs);
+	}
+
+      if (dirs == top)
+	{
+	  path_put (path);
+	  return 0;
+	}
+      subdir = stream_release (dirs->parentdir, dirs);
+      dirs = dirs->parentdir;
+    }
+}
+
+/* Create the album with a memory usage, which depends on the biggest
+   directory and not on the size of the album. The directories are
+   scanned by one thread, the nails are still created by max_jobs
+   jobs. Returns 0 on success, 1 if the root directory could not be
+   read.  */
+int
+stream_album (const char *root_path, dir_l *rootdir)
+{
+  int ret;
+
+  visited = hash_create (1024);
+  ret = stream_dir (root_path, rootdir);
+  hash_free (visited, NULL);
+  visited = NULL;
+
+  return ret;
+}
@@ -0,0 +1,213 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+/* The album is split into subtrees, which are distributed over N
+   shards, so that every shard has about the same number of images.
+   Every shard creates the nails and pages of its subtrees. The
+   directories above the subtrees are marked as ancestor, their pages
+   are created by the merge step after all shards are finished. The
+   partition only depends on the content of the album, so every host
+   computes the same one.  */
+
+typedef struct {
+  dir_l *dir;
+  unsigned long long images;  /* number of images in the subtree */
+  int shard;
+} shard_unit_t;
+
+static unsigned long long
+count_images (dir_l *top)
+{
+  unsigned long long count = 0;
+  dir_l *dir;
+
+  for (dir = top; dir != NULL; dir = next_dir (top, dir, 1))
+    count += dir->images.count;
+
+  return count;
+}
+
+static void
+add_unit (shard_unit_t **units, size_t *nr_units, dir_l *dir)
+{
+  /* grow the array whenever nr_units reaches a power of two */
+  if ((*nr_units & (*nr_units - 1)) == 0)
+    {
+      size_t size = *nr_units ? *nr_units * 2 : 1;
+
+      *units = realloc (*units, size * sizeof (shard_unit_t));
+      if (*units == NULL)
+	yapa_oom ();
+    }
+
+  (*units)[*nr_units].dir = dir;
+  (*units)[*nr_units].images = count_images (dir);
+  (*units)[*nr_units].shard = 0;
+  (*nr_units)++;
+}
+
+/* Biggest subtrees first, the path makes the order unique.  */
+static int
+cmp_units (const void *p1, const void *p2)
+{
+  const shard_unit_t *u1 = p1, *u2 = p2;
+  int ret;
+
+  if (u1->images != u2->images)
+    return u1->images > u2->images ? -1 : 1;
+
+  ret = strcmp (u1->dir->path, u2->dir->path);
+  if (ret == 0)
+    ret = strcmp (u1->dir->name, u2->dir->name);
+  return ret;
+}
+
+/* Split the album into subtrees and assign them to the shards with
+   the longest processing time first rule: the next biggest subtree
+   goes to the shard with the fewest images so far. Subtrees with
+   more images than a shard should get are split into their
+   subdirectories first.  */
+static shard_unit_t *
+partition (dir_l *rootdir, int nr_shards, size_t *nr_units)
+{
+  unsigned long long total, limit, *load;
+  shard_unit_t *units = NULL;
+  dir_l *subdir;
+  size_t i;
+
+  *nr_units = 0;
+  rootdir->ancestor = 1;
+  for (subdir = rootdir->subdirs.first; subdir != NULL; subdir = subdir->next)
+    add_unit (&units, nr_units, subdir);
+
+  total = count_images (rootdir);
+  limit = (total + nr_shards - 1) / nr_shards;
+
+  while (1)
+    {
+      size_t biggest = *nr_units;
+      dir_l *dir;
+
+      for (i = 0; i < *nr_units; i++)
+	if (units[i].images > limit && units[i].dir->subdirs.first != NULL &&
+	    (biggest == *nr_units || units[i].images > units[biggest].images))
+	  biggest = i;
+      if (biggest == *nr_units)
+	break;
+
+      /* replace the subtree with the ones of its subdirectories */
+      dir = units[biggest].dir;
+      dir->ancestor = 1;
+      units[biggest] = units[--*nr_units];
+      for (subdir = dir->subdirs.first; subdir != NULL; subdir = subdir->next)
+	add_unit (&units, nr_units, subdir);
+    }
+
+  if (*nr_units == 0)
+    return units;
+
+  qsort (units, *nr_units, sizeof (shard_unit_t), cmp_units);
+
+  load = calloc (nr_shards, sizeof (unsigned long long));
+  if (load == NULL)
+    yapa_oom ();
+  for (i = 0; i < *nr_units; i++)
+    {
+      int j, min = 0;
+
+      for (j = 1; j < nr_shards; j++)
+	if (load[j] < load[min])
+	  min = j;
+      units[i].shard = min;
+      load[min] += units[i].images;
+    }
+  free (load);
+
+  return units;
+}
+
+/* The pages of a subtree show the labels of the directories above
+   it, which are not sorted by this shard.  */
+static void
+read_ancestor_labels (dir_l *top)
+{
+  dir_l *dir;
+
+  for (dir = top; dir != NULL; dir = next_dir (top, dir, dir->ancestor))
+    if (dir->ancestor)
+      read_directory_labels (dir);
+}
+
+/* Create the nails and pages of all subtrees of shard, which counts
+   from 0.  */
+void
+update_shard (dir_l *rootdir, int shard, int nr_shards)
+{
+  unsigned long long images = 0;
+  shard_unit_t *units;
+  size_t i, nr_units, count = 0;
+
+  units = partition (rootdir, nr_shards, &nr_units);
+
+  for (i = 0; i < nr_units; i++)
+    if (units[i].shard == shard)
+      {
+	count++;
+	images += units[i].images;
+      }
+  printf (_("Shard %i/%i: %zu directories with %llu images\n"),
+	  shard + 1, nr_shards, count, images);
+
+  read_ancestor_labels (rootdir);
+
+  for (i = 0; i < nr_units; i++)
+    if (units[i].shard == shard)
+      update_html (units[i].dir);
+
+  free (units);
+}
+
+static void
+merge_dir (dir_l *top)
+{
+  dir_l *dir;
+
+  for (dir = top; dir != NULL; dir = next_dir (top, dir, dir->ancestor))
+    if (dir->ancestor)
+      /* sorts the subdirectories and writes yapa/directories */
+      update_directory (dir);
+}
+
+/* Create the pages of the directories above the subtrees of all
+   shards.  */
+void
+merge_shards (dir_l *rootdir, int nr_shards)
+{
+  size_t nr_units;
+
+  free (partition (rootdir, nr_shards, &nr_units));
+  merge_dir (rootdir);
+}
@@ -0,0 +1,212 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "main.h"
+
+/* Scanning the album is dominated by filesystem syscalls, on NFS
+   every one is a network round trip. All of them are done with the
+   helpers here, which count them per phase for --stats.  */
+
+int stats_flag = 0;
+
+static const char *phase_names[NR_PHASES] = {
+  [PHASE_SCAN] = "scan",
+  [PHASE_NAILS] = "nails",
+  [PHASE_HTML] = "html",
+};
+
+static const char *syscall_names[NR_SYSCALLS] = {
+  [SYS_OPENDIR] = "opendir",
+  [SYS_READDIR] = "readdir",
+  [SYS_STAT] = "stat",
+  [SYS_OPEN] = "open",
+};
+
+static unsigned long counters[NR_PHASES][NR_SYSCALLS];
+static int current_phase = PHASE_SCAN;
+
+/* Set the current phase and return the old one.  */
+int
+set_stats_phase (int phase)
+{
+  int old = current_phase;
+
+  current_phase = phase;
+  return old;
+}
+
+void
+count_syscall (int syscall)
+{
+  /* the directories are scanned by several threads */
+  __atomic_add_fetch (&counters[current_phase][syscall], 1, __ATOMIC_RELAXED);
+}
+
+static int
+stat_entry_flags (int dirfd, const char *name, int flags, unsigned int *mode,
+		  time_t *mtime)
+{
+  count_syscall (SYS_STAT);
+
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  /* only ask for what we need, this is cheaper on network
+     filesystems */
+  if (statx (dirfd, name, AT_STATX_SYNC_AS_STAT | flags,
+	     STATX_TYPE | STATX_MTIME, &stx) != 0)
+    return -1;
+  if (mode)
+    *mode = stx.stx_mode;
+  if (mtime)
+    *mtime = stx.stx_mtime.tv_sec;
+#else
+  struct stat st;
+
+  if (fstatat (dirfd, name, &st, flags) != 0)
+    return -1;
+  if (mode)
+    *mode = st.st_mode;
+  if (mtime)
+    *mtime = st.st_mtime;
+#endif
+
+  return 0;
+}
+
+/* Get the file type and modification time of a directory entry,
+   relative to the directory fd. Symlinks are followed like stat()
+   does. Returns 0 on success, -1 on error.  */
+int
+stat_entry (int dirfd, const char *name, unsigned int *mode, time_t *mtime)
+{
+  return stat_entry_flags (dirfd, name, 0, mode, mtime);
+}
+
+/* Get device, inode and modification time of a directory for the
+   scan cache. Returns 0 on success, -1 on error.  */
+int
+stat_dir (const char *path, unsigned long long *dev, unsigned long long *ino,
+	  struct timespec *mtime)
+{
+  count_syscall (SYS_STAT);
+
+#ifdef HAVE_STATX
+  struct statx stx;
+
+  if (statx (AT_FDCWD, path, AT_STATX_SYNC_AS_STAT,
+	     STATX_INO | STATX_MTIME, &stx) != 0)
+    return -1;
+  *dev = makedev (stx.stx_dev_major, stx.stx_dev_minor);
+  *ino = stx.stx_ino;
+  mtime->tv_sec = stx.stx_mtime.tv_sec;
+  mtime->tv_nsec = stx.stx_mtime.tv_nsec;
+#else
+  struct stat st;
+
+  if (stat (path, &st) != 0)
+    return -1;
+  *dev = st.st_dev;
+  *ino = st.st_ino;
+  *mtime = st.st_mtim;
+#endif
+
+  return 0;
+}
+
+/* Returns DT_DIR or DT_REG for directories and regular files, taken
+   from d_type if the filesystem provides it, DT_LNK for symlinks to
+   directories, else DT_UNKNOWN. Symlinks to files are DT_REG.  */
+int
+get_entry_type (int dirfd, const struct dirent *d)
+{
+  unsigned int mode;
+  int is_link = 0;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (d->d_type == DT_DIR || d->d_type == DT_REG)
+    return d->d_type;
+  if (d->d_type != DT_UNKNOWN && d->d_type != DT_LNK)
+    return DT_UNKNOWN;
+  is_link = (d->d_type == DT_LNK);
+#endif
+
+  if (!is_link)
+    {
+      if (stat_entry_flags (dirfd, d->d_name, AT_SYMLINK_NOFOLLOW,
+			    &mode, NULL) != 0)
+	return DT_UNKNOWN;
+      if (S_ISDIR (mode))
+	return DT_DIR;
+      if (S_ISREG (mode))
+	return DT_REG;
+      if (!S_ISLNK (mode))
+	return DT_UNKNOWN;
+    }
+
+  if (stat_entry (dirfd, d->d_name, &mode, NULL) != 0)
+    return DT_UNKNOWN;
+  if (S_ISDIR (mode))
+    return DT_LNK;
+  if (S_ISREG (mode))
+    return DT_REG;
+  return DT_UNKNOWN;
+}
+
+DIR *
+open_dir (const char *path)
+{
+  count_syscall (SYS_OPENDIR);
+  return opendir (path);
+}
+
+struct dirent *
+read_dir (DIR *dir)
+{
+  count_syscall (SYS_READDIR);
+  return readdir (dir);
+}
+
+void
+print_stats (void)
+{
+  int phase, sys;
+
+  printf ("%-8s", "syscalls");
+  for (sys = 0; sys < NR_SYSCALLS; sys++)
+    printf (" %10s", syscall_names[sys]);
+  printf ("\n");
+
+  for (phase = 0; phase < NR_PHASES; phase++)
+    {
+      printf ("%-8s", phase_names[phase]);
+      for (sys = 0; sys < NR_SYSCALLS; sys++)
+	printf (" %10lu", counters[phase][sys]);
+      printf ("\n");
+    }
+}
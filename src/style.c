@@ -92,35 +92,46 @@ create_html_frame_line (FILE *fp)
   fprintf (fp, "	</tr>\n");
 }
 
+/* Links to the directories from the root down to dir.  */
 static void
-print_html_path (FILE *fp, dir_l *dir, int level)
+print_html_path (FILE *fp, dir_l *dir)
 {
-  if (dir->parentdir)
-    print_html_path (fp, dir->parentdir, level + 1);
+  dir_l *entry;
+  int level = 0;
 
-  if (dir->name == NULL && level == 0)
-    {
-      char *cp = get_dir_label (dir);
-      fprintf (fp, "%s\n", cp);
-      free (cp);
-    }
-  else
+  for (entry = dir; entry->parentdir != NULL; entry = entry->parentdir)
+    level++;
+
+  for (; level >= 0; level--)
     {
       int i;
       char *cp;
 
+      /* the directory level steps above dir */
+      entry = dir;
+      for (i = 0; i < level; i++)
+	entry = entry->parentdir;
+
+      if (entry->name == NULL && level == 0)
+	{
+	  cp = get_dir_label (entry);
+	  fprintf (fp, "%s\n", cp);
+	  free (cp);
+	  continue;
+	}
+
       fprintf (fp, "<a href=\"");
       for (i = 0; i < level; i++)
 	fprintf (fp, "../");
       if (level == 0)
 	{
-	  cp = get_dir_label (dir);
+	  cp = get_dir_label (entry);
 	  fprintf (fp, "index.html\"><i>%s</i></a>", cp);
 	  free (cp);
 	}
       else
 	{
-	  cp = get_dir_label (dir);
+	  cp = get_dir_label (entry);
 	  fprintf (fp, "index.html\">%s</a>", cp);
 	  free (cp);
 	  fprintf (fp, "  &gt;");
@@ -192,7 +203,7 @@ create_html_frame_start (FILE *fp, const char *label,
   fprintf (fp, "		  <td align=\"center\" valign=\"middle\">\n");
   fprintf (fp, "		    <font size=\"+1\">\n");
 
-  print_html_path (fp, dir, 0);
+  print_html_path (fp, dir);
 
   fprintf (fp, "</font>\n");
   fprintf (fp, "		  </td>\n");
@@ -201,20 +212,20 @@ create_html_frame_start (FILE *fp, const char *label,
   /* Insert directory description */
   if (is_index)
     {
-      txt_l *descr= get_txt_entry (dir->texts, "directory");
+      txt_l *descr= get_txt_entry (&dir->texts, "directory");
 
       if (descr != NULL)
 	{
-	  char *fname;
+	  path_t *fname = path_get ();
 	  FILE *tp;
 	  char *buf = NULL;
 	  size_t buflen = 0;
 
 
-	  if (asprintf (&fname, "%s/%s", descr->path, descr->name) < 0)
-	    yapa_oom ();
-	  tp = fopen (fname, "r");
-	  free (fname);
+	  path_set (fname, descr->path);
+	  count_syscall (SYS_OPEN);
+	  tp = fopen (path_add (fname, descr->name), "r");
+	  path_put (fname);
 	  fprintf (fp, "<tr><td align=\"center\" valign=\"middle\"><p>\n");
 	  while (!feof (tp))
 	    {
@@ -291,30 +302,117 @@ get_label (image_l *img)
   return buf;
 }
 
+/* Write an URL of a srcset candidate, spaces and commas would be
+   parsed as separator.  */
+static void
+print_srcset_url (FILE *fp, const char *nailname, const char *name)
+{
+  fprintf (fp, "yapa/%s/", nailname);
+  for (; *name != '\0'; name++)
+    {
+      if (*name == ' ')
+	fputs ("%20", fp);
+      else if (*name == ',')
+	fputs ("%2C", fp);
+      else
+	fputc (*name, fp);
+    }
+}
+
+/* Write the <img> tag of the midnail. If srcset sizes are configured,
+   the browser can choose the nail fitting best to the screen, the
+   midnail defines the size on the page.  */
+static void
+print_midnail (FILE *fp, image_l *img, dir_l *dir)
+{
+  unsigned int width, height, nail_width, nail_height;
+  unsigned int widths[MAX_SRCSET + 1];
+  int sizes[MAX_SRCSET + 1];
+  path_t *filename = path_get (), *nailbuf = path_get ();
+  const char *nailfile;
+  int count = 0, i, j;
+
+  nailfile = get_nail_filename (nailbuf, img->name, &dir->config);
+  fprintf (fp, "<img src=\"yapa/midnails/%s\"", nailfile);
+
+  path_set (filename, img->srcdir);
+  path_add (filename, img->name);
+
+  if (dir->config.srcset_count > 0 &&
+      get_image_dimensions (filename->str, &width, &height) == 0)
+    {
+      /* candidates sorted by width, sizes resulting in the same
+	 width are the same image, prefer the midnail */
+      for (i = -1; i < dir->config.srcset_count; i++)
+	{
+	  int size = (i < 0) ? dir->config.midnail : dir->config.srcset[i];
+
+	  get_nail_size (width, height, size, &nail_width, &nail_height);
+	  for (j = 0; j < count && widths[j] < nail_width; j++)
+	    ;
+	  if (j < count && widths[j] == nail_width)
+	    continue;
+	  memmove (&widths[j + 1], &widths[j],
+		   (count - j) * sizeof (widths[0]));
+	  memmove (&sizes[j + 1], &sizes[j],
+		   (count - j) * sizeof (sizes[0]));
+	  widths[j] = nail_width;
+	  sizes[j] = size;
+	  ++count;
+	}
+
+      fprintf (fp, " srcset=\"");
+      for (i = 0; i < count; i++)
+	{
+	  char nailname[16];
+
+	  if (sizes[i] == dir->config.midnail)
+	    strcpy (nailname, "midnails");
+	  else if (sizes[i] == dir->config.thumbnail)
+	    strcpy (nailname, "thumbnails");
+	  else
+	    snprintf (nailname, sizeof (nailname), "nails-%d", sizes[i]);
+	  if (i > 0)
+	    fputs (", ", fp);
+	  print_srcset_url (fp, nailname, nailfile);
+	  fprintf (fp, " %uw", widths[i]);
+	}
+      get_nail_size (width, height, dir->config.midnail,
+		     &nail_width, &nail_height);
+      fprintf (fp, "\" sizes=\"(max-width: %upx) 100vw, %upx\"",
+	       nail_width, nail_width);
+    }
+  path_put (filename);
+  path_put (nailbuf);
+
+  fprintf (fp, " border=\"0\" title=\"Click on image for full view\">");
+}
+
 void
 create_html_image (image_l *img, dir_l *dir, unsigned long long imgnumber)
 {
   FILE *fp;
-  char *cp, *filename;
-  txt_l *descr = get_txt_entry (dir->texts, img->name);
+  char *cp;
+  path_t *filename = path_get ();
+  txt_l *descr = get_txt_entry (&dir->texts, img->name);
 
-  if (asprintf (&filename, "%s/%s.html", img->dstdir, img->name) < 0)
-    yapa_oom ();
+  path_set (filename, img->dstdir);
+  path_add (filename, img->name);
+  path_append (filename, ".html");
   if (debug_flag)
-    printf ("========>CREATE HTML: %s\n",filename);
+    printf ("========>CREATE HTML: %s\n", filename->str);
   else
     printf ("Create html file for %s\n", img->name);
 
   load_exif_data (img);
 
-  fp = fopen (filename, "w");
-  free (filename);
-
+  fp = fopen (filename->str, "w");
   if (fp == NULL)
     {
-      fprintf (stderr, "ERROR: Cannot create %s: %m", filename);
+      fprintf (stderr, "ERROR: Cannot create %s: %m", filename->str);
       exit (1);
     }
+  path_put (filename);
 
   cp = get_label (img);
   create_html_frame_start (fp, cp, dir, img, 0);
@@ -364,20 +462,22 @@ create_html_image (image_l *img, dir_l *dir, unsigned long long imgnumber)
   fprintf (fp, "			  <tr>\n");
   fprintf (fp, "			    <td>\n");
   //  fprintf (fp, "			      <a href=\"%s\"><img src=\"yapa/midnails/%s\" width=\"640\" height=\"480\" border=\"0\" title=\"Click on image for full view\"></a>\n", img->name, img->name);
-  if (strcmp (img->srcdir, img->dstdir) != 0)
+  if (img->srcdir != img->dstdir)
     {
       /* Directory where the image is stored is not the directory we
 	 create the html page */
-      char *relpath;
+      const char *relpath;
 
       /* srcdir is always dstdir + relative path to image from links file */
       relpath = img->srcdir;
       relpath+=(strlen (img->dstdir) + 1);
 
-      fprintf (fp, "			      <a href=\"%s/%s\"><img src=\"yapa/midnails/%s\" border=\"0\" title=\"Click on image for full view\"></a>\n", relpath, img->name, img->name);
+      fprintf (fp, "			      <a href=\"%s/%s\">", relpath, img->name);
     }
   else
-    fprintf (fp, "			      <a href=\"%s\"><img src=\"yapa/midnails/%s\" border=\"0\" title=\"Click on image for full view\"></a>\n", img->name, img->name);
+    fprintf (fp, "			      <a href=\"%s\">", img->name);
+  print_midnail (fp, img, dir);
+  fprintf (fp, "</a>\n");
   fprintf (fp, "			    </td>\n");
   fprintf (fp, "			  </tr>\n");
   fprintf (fp, "		      </table>\n");
@@ -386,7 +486,7 @@ create_html_image (image_l *img, dir_l *dir, unsigned long long imgnumber)
 
   if (descr)
     {
-      char *fname;
+      path_t *fname = path_get ();
       FILE *tp;
       char *buf = NULL;
       size_t buflen = 0;
@@ -397,10 +497,10 @@ create_html_image (image_l *img, dir_l *dir, unsigned long long imgnumber)
       fprintf (fp, "    <td>\n");
       fprintf (fp, "      <p>\n");
 
-      if (asprintf (&fname, "%s/%s", descr->path, descr->name) < 0)
-	yapa_oom ();
-      tp = fopen (fname, "r");
-      free (fname);
+      path_set (fname, descr->path);
+      count_syscall (SYS_OPEN);
+      tp = fopen (path_add (fname, descr->name), "r");
+      path_put (fname);
       while (!feof (tp))
         {
           ssize_t n = getline (&buf, &buflen, tp);
@@ -491,45 +591,27 @@ create_html_image (image_l *img, dir_l *dir, unsigned long long imgnumber)
   create_html_frame_end (fp);
 
   fclose (fp);
+  free_exif_data (img);
 }
 
 static void
 create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
 {
   FILE *fp;
-  char *filename;
-  dir_l *subdir = dir->subdirs;
-  image_l *image = dir->images;
-  gpx_l *gpx = dir->gpx;
+  path_t *filename = path_get ();
+  dir_l *subdir = dir->subdirs.first;
+  image_l *image = dir->images.first;
+  gpx_l *gpx = dir->gpx.first;
 
+  path_dir (filename, dir);
   if (pagenr == 1)
-    {
-      if (dir->name == NULL)
-	{
-	  if (asprintf (&filename, "%s/index.html", dir->path) < 0)
-	    yapa_oom ();
-	}
-      else
-	{
-	  if (asprintf (&filename, "%s/%s/index.html",
-			dir->path, dir->name) < 0)
-	    yapa_oom ();
-	}
-    }
+    path_add (filename, "index.html");
   else
     {
-      if (dir->name == NULL)
-	{
-	  if (asprintf (&filename, "%s/index-%d.html",
-			dir->path, pagenr) < 0)
-	    yapa_oom ();
-	}
-      else
-	{
-	  if (asprintf (&filename, "%s/%s/index-%d.html",
-			dir->path, dir->name, pagenr) < 0)
-	    yapa_oom ();
-	}
+      char indexname[32];
+
+      snprintf (indexname, sizeof (indexname), "index-%d.html", pagenr);
+      path_add (filename, indexname);
     }
 
   if (!dir->force_html && !force_html_flag && dir->mtime > dir->descr_mtime)
@@ -538,7 +620,8 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
 
       /* File exists and we don't need to recreate them,
 	 return */
-      if (stat (filename, &st) == 0)
+      count_syscall (SYS_STAT);
+      if (stat (filename->str, &st) == 0)
 	{
 	  /* ../yapa/directories and yapa/directories should be
 	     older */
@@ -546,25 +629,24 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
 	      (dir->parentdir == NULL ||
 	       st.st_mtime > dir->parentdir->directory_mtime))
 	    {
-	      free (filename);
+	      path_put (filename);
 	      return;
 	    }
 	}
     }
 
   if (debug_flag)
-    printf ("========>CREATE HTML: %s\n",filename);
+    printf ("========>CREATE HTML: %s\n", filename->str);
   else
-    printf ("Create index file %s\n", basename (filename));
-
-  fp = fopen (filename, "w");
-  free (filename);
+    printf ("Create index file %s\n", basename (filename->str));
 
+  fp = fopen (filename->str, "w");
   if (fp == NULL)
     {
-      fprintf (stderr, "ERROR: Cannot create %s: %m", filename);
+      fprintf (stderr, "ERROR: Cannot create %s: %m", filename->str);
       exit (1);
     }
+  path_put (filename);
 
   char *cp = get_dir_label (dir);
   create_html_frame_start (fp, cp, dir, NULL, 1);
@@ -616,7 +698,7 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
       fprintf (fp, "</tr>\n");
     }
 
-  if (dir->subdirs && dir->gpx)
+  if (dir->subdirs.first && dir->gpx.first)
     create_html_frame_line (fp);
 
   if (gpx != NULL)
@@ -665,10 +747,10 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
       fprintf (fp, "</tr>\n");
     }
 
-  if (dir->gpx && dir->images)
+  if (dir->gpx.first && dir->images.first)
     create_html_frame_line (fp);
 
-  if (dir->subdirs && !dir->gpx && dir->images)
+  if (dir->subdirs.first && !dir->gpx.first && dir->images.first)
     create_html_frame_line (fp);
 
   if (image != NULL)
@@ -720,6 +802,7 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
       fprintf (fp, "      <tr>\n");
 
 
+      path_t *nailfile = path_get ();
       int start = 1;
       while (start < (pagenr - 1) * dir->config.imagerows * dir->config.imagecols + 1)
 	{
@@ -733,7 +816,9 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
 	  fprintf (fp, "<table border=\"0\" cellpadding=\"5\" cellspacing=\"0\" bgcolor=\"#ffffff\">\n");
 	  fprintf (fp, "  <tr>\n");
 	  fprintf (fp, "    <td><a href=\"%s.html\"><img src=\"yapa/thumbnails/%s\" border=\"0\" ALT=\"%s\"></a></td>\n",
-		   image->name, image->name, image->name);
+		   image->name,
+		   get_nail_filename (nailfile, image->name, &dir->config),
+		   image->name);
 	  cp = get_label (image);
 	  fprintf (fp, "</tr></table><br>%s</td>\n", cp);
 	  free (cp);
@@ -744,6 +829,7 @@ create_html_index_nr (dir_l *dir, int pagenr, int maxpages, int maximages)
 	  if (count % (dir->config.imagecols * dir->config.imagerows) == 0)
 	    break;
 	}
+      path_put (nailfile);
 
       fprintf (fp, "      </tr>\n");
       fprintf (fp, "      </table>\n");
@@ -808,7 +894,7 @@ void
 create_html_index (dir_l *dir)
 {
   int maximages, maxpages, i;
-  image_l *image = dir->images;
+  image_l *image = dir->images.first;
 
   maximages = 0;
   while (image != NULL)
@@ -25,85 +25,46 @@
 #include "main.h"
 
 
+/* path is not copied, it has to live as long as the entry, see
+   scan_dir.  */
 txt_l *
-add_txt (txt_l **descr, const char *path,
+add_txt (dir_l *dir, const char *path,
 	 const char *filename, time_t mtime)
 {
+  arena_t *arena = dir_arena (dir);
+  txt_l *new = arena_alloc (arena, sizeof (txt_l));
+
   if (debug_flag)
     printf ("ADD TEXT: %s\n", path);
 
-  if (*descr == NULL)
-    {
-      *descr = calloc (1, sizeof (txt_l));
-      if (filename != NULL)
-	(*descr)->name = strdup (filename);
-      (*descr)->path = strdup (path);
-      (*descr)->mtime = mtime;
-      return *descr;
-    }
-  else
-    {
-      txt_l *ptr, *new = calloc (1, sizeof (txt_l));
-
-      ptr = *descr;
-      while (ptr->next != NULL)
-	ptr = ptr->next;
-
-      ptr->next = new;
-      new->prev = ptr;
-      if (filename != NULL)
-	new->name = strdup (filename);
-      new->path = strdup (path);
-      new->mtime = mtime;
-      return new;
-    }
-}
-
-void
-free_txt (txt_l **ptr)
-{
-  if ((*ptr)->name)
-    free ((*ptr)->name);
-  if ((*ptr)->path)
-    free ((*ptr)->path);
-
-  if ((*ptr)->next != NULL)
-    free_txt (&((*ptr)->next));
-  free (*ptr);
+  if (filename != NULL)
+    new->name = arena_strdup (arena, filename);
+  new->path = path;
+  new->mtime = mtime;
+  list_append (&dir->texts, new);
+  return new;
 }
 
+/* The description of foo.jpg is foo.txt or foo.jpg.txt.  */
 txt_l *
-get_txt_entry (txt_l *txt, const char *name)
+get_txt_entry (list_t *txt, const char *name)
 {
-  txt_l *ptr = txt;
-  char *cp, *fullname, *shortname = strdup (name);
+  path_t *txtname = path_get ();
+  const char *cp = strrchr (name, '.');
+  txt_l *ptr = NULL;
 
-  cp = strrchr (shortname, '.');
+  path_set (txtname, name);
   if (cp)
     {
-      *cp='\0';
-      cp = shortname;
-      if (asprintf (&shortname, "%s.txt", cp) < 0)
-	yapa_oom ();
-      free (cp);
+      path_truncate (txtname, cp - name);
+      ptr = list_lookup (txt, path_append (txtname, ".txt"));
+      path_set (txtname, name);
     }
-  if (asprintf (&fullname, "%s.txt", name) < 0)
-    yapa_oom ();
+  if (ptr == NULL)
+    ptr = list_lookup (txt, path_append (txtname, ".txt"));
 
-  while (ptr)
-    {
-      if (strcmp (ptr->name, shortname) == 0 ||
-	  strcmp (ptr->name, fullname) == 0)
-	{
-	  free (shortname);
-	  free (fullname);
-	  return ptr;
-	}
-      ptr = ptr->next;
-    }
-  free (shortname);
-  free (fullname);
-  return NULL;
+  path_put (txtname);
+  return ptr;
 }
 
 #if 0
@@ -0,0 +1,516 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "main.h"
+
+/* --watch: after the album is created, every directory of the album
+   and its yapa directory is watched with inotify. If there were no
+   new events for WATCH_DEBOUNCE ms, the changed directories are read
+   again and only their nails and html pages are updated. The pages
+   written by yapa itself are ignored, else every update would
+   trigger the next one. If the kernel lost events, the whole album
+   is read again.  */
+
+#define WATCH_DEBOUNCE 1000
+
+#define DIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_CLOSE_WRITE | IN_ONLYDIR)
+#define YAPA_EVENTS (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		     IN_CLOSE_WRITE | IN_ONLYDIR)
+
+typedef struct watch_t {
+  char *path;    /* watched directory, NULL if the slot is free */
+  int yapa_dir;  /* this is the yapa directory of path/.. */
+} watch_t;
+
+static int inotify_fd = -1;
+static watch_t *watches = NULL; /* indexed by watch descriptor */
+static int nr_watches = 0;
+static int events_lost = 0;
+static hash_table_t *changed_dirs = NULL;
+static list_t obsolete_dirs; /* freed after the jobs finished */
+static volatile sig_atomic_t stop_watching = 0;
+
+static void
+stop_handler (int sig __attribute__((unused)))
+{
+  stop_watching = 1;
+}
+
+static int
+has_suffix (const char *name, const char *suffix)
+{
+  size_t len = strlen (name), slen = strlen (suffix);
+
+  return len >= slen && strcasecmp (&name[len - slen], suffix) == 0;
+}
+
+/* Files written by the user, the html pages are created by yapa.  */
+static int
+is_album_file (const char *name)
+{
+  return has_suffix (name, ".jpg") || has_suffix (name, ".png") ||
+    has_suffix (name, ".txt") || has_suffix (name, ".gpx") ||
+    strcmp (name, ".yapaignore") == 0;
+}
+
+/* Control files in the yapa directory, which are edited by the
+   user. yapa/nails and yapa/scancache are written by yapa only.  */
+static int
+is_control_file (const char *name)
+{
+  return strcmp (name, "config") == 0 || strcmp (name, "links") == 0 ||
+    strcmp (name, "directories") == 0 || strcmp (name, "images") == 0 ||
+    strcmp (name, "gpx") == 0 || strcmp (name, "root") == 0;
+}
+
+static void
+add_watch (const char *path, int yapa_dir)
+{
+  int wd = inotify_add_watch (inotify_fd, path,
+			      yapa_dir ? YAPA_EVENTS : DIR_EVENTS);
+
+  if (wd < 0)
+    {
+      if (errno == ENOSPC)
+	fprintf (stderr, _("ERROR: Cannot watch %s, increase "
+			   "fs.inotify.max_user_watches\n"), path);
+      else if (errno != ENOENT)
+	fprintf (stderr, _("ERROR: Cannot watch %s: %m\n"), path);
+      return;
+    }
+
+  if (wd >= nr_watches)
+    {
+      int size = wd + 64;
+
+      watches = realloc (watches, size * sizeof (watch_t));
+      if (watches == NULL)
+	yapa_oom ();
+      memset (&watches[nr_watches], 0,
+	      (size - nr_watches) * sizeof (watch_t));
+      nr_watches = size;
+    }
+
+  /* the same directory can be added twice */
+  free (watches[wd].path);
+  watches[wd].path = strdup (path);
+  if (watches[wd].path == NULL)
+    yapa_oom ();
+  watches[wd].yapa_dir = yapa_dir;
+}
+
+/* Watch a directory with all subdirectories.  */
+static void
+watch_tree (const char *path)
+{
+  struct dirent *d;
+  DIR *dir;
+
+  add_watch (path, 0);
+
+  dir = open_dir (path);
+  if (dir == NULL)
+    return;
+
+  while ((d = read_dir (dir)) != NULL)
+    {
+      char *buf;
+
+      if (d->d_name[0] == '.' ||
+	  strcmp (d->d_name, "picfolio") == 0 ||
+	  strcmp (d->d_name, "GPXViewer") == 0 ||
+	  get_entry_type (dirfd (dir), d) != DT_DIR)
+	continue;
+
+      if (asprintf (&buf, "%s/%s", path, d->d_name) < 0)
+	yapa_oom ();
+      if (strcmp (d->d_name, "yapa") == 0)
+	add_watch (buf, 1);
+      else
+	watch_tree (buf);
+      free (buf);
+    }
+  closedir (dir);
+}
+
+static void
+init_watches (const char *root_path)
+{
+  int i;
+
+  if (inotify_fd >= 0)
+    close (inotify_fd);
+  for (i = 0; i < nr_watches; i++)
+    {
+      free (watches[i].path);
+      watches[i].path = NULL;
+    }
+
+  inotify_fd = inotify_init1 (IN_CLOEXEC);
+  if (inotify_fd < 0)
+    return;
+  watch_tree (root_path);
+}
+
+static void
+mark_changed (const char *path)
+{
+  if (debug_flag)
+    printf ("CHANGED DIRECTORY: %s\n", path);
+  hash_insert (changed_dirs, path, changed_dirs);
+}
+
+static void
+handle_event (const struct inotify_event *ev)
+{
+  watch_t *w;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+    {
+      events_lost = 1;
+      return;
+    }
+  if (ev->wd < 0 || ev->wd >= nr_watches || watches[ev->wd].path == NULL)
+    return;
+  w = &watches[ev->wd];
+
+  if (ev->mask & IN_IGNORED)
+    {
+      /* directory was removed */
+      free (w->path);
+      w->path = NULL;
+      return;
+    }
+  if (ev->len == 0 ||
+      (ev->name[0] == '.' && strcmp (ev->name, ".yapaignore") != 0))
+    return;
+
+  if (w->yapa_dir)
+    {
+      if (is_control_file (ev->name))
+	{
+	  char *cp = strdup (w->path);
+
+	  if (cp == NULL)
+	    yapa_oom ();
+	  *strrchr (cp, '/') = '\0';
+	  mark_changed (cp);
+	  free (cp);
+	}
+    }
+  else if (ev->mask & IN_ISDIR)
+    {
+      char *buf;
+
+      if (strcmp (ev->name, "picfolio") == 0 ||
+	  strcmp (ev->name, "GPXViewer") == 0)
+	return;
+
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+	{
+	  if (asprintf (&buf, "%s/%s", w->path, ev->name) < 0)
+	    yapa_oom ();
+	  if (strcmp (ev->name, "yapa") == 0)
+	    add_watch (buf, 1);
+	  else
+	    watch_tree (buf);
+	  free (buf);
+	}
+      /* yapa creates the yapa directories itself */
+      if (strcmp (ev->name, "yapa") != 0)
+	mark_changed (w->path);
+    }
+  else if (is_album_file (ev->name))
+    mark_changed (w->path);
+}
+
+static int
+read_events (void)
+{
+  char buf[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t len = read (inotify_fd, buf, sizeof (buf));
+  char *ptr;
+
+  if (len < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  for (ptr = buf; ptr < buf + len;)
+    {
+      const struct inotify_event *ev = (const struct inotify_event *) ptr;
+
+      handle_event (ev);
+      ptr += sizeof (struct inotify_event) + ev->len;
+    }
+  return 0;
+}
+
+/* Search the entry of a directory in the tree.  */
+static dir_l *
+find_dir (dir_l *rootdir, const char *root_path, const char *path)
+{
+  size_t len = strlen (root_path);
+  dir_l *dir = rootdir;
+  char *copy, *cp, *saveptr;
+
+  if (strncmp (path, root_path, len) != 0 ||
+      (path[len] != '\0' && path[len] != '/'))
+    return NULL;
+
+  copy = strdup (&path[len]);
+  if (copy == NULL)
+    yapa_oom ();
+
+  for (cp = strtok_r (copy, "/", &saveptr); cp != NULL && dir != NULL;
+       cp = strtok_r (NULL, "/", &saveptr))
+    {
+      dir = list_lookup (&dir->subdirs, cp);
+    }
+  free (copy);
+
+  return dir;
+}
+
+static int
+has_subdir (dir_l *dir, const char *name)
+{
+  return list_lookup (&dir->subdirs, name) != NULL;
+}
+
+/* Read a directory of the tree again and update its nails and html
+   pages. New subdirectories and all subdirectories of a directory
+   with a changed config are updated completely, with full set all
+   of them.  */
+static void
+update_dir (dir_l **rootdir, dir_l *old, int full)
+{
+  dir_l *new, *subdir, **added;
+  char *directory;
+  size_t nr_added = 0;
+
+  if (old->name == NULL)
+    directory = strdup (old->path);
+  else if (asprintf (&directory, "%s/%s", old->path, old->name) < 0)
+    directory = NULL;
+  if (directory == NULL)
+    yapa_oom ();
+
+  new = new_dir (old->path, old->name);
+  new->parentdir = old->parentdir;
+  if (old->parentdir != NULL)
+    new->ignore = old->parentdir->ignore;
+  if (old->parentdir == NULL)
+    get_root_config (new);
+  new->config = get_config (new, old->parentdir);
+
+  set_stats_phase (PHASE_SCAN);
+  if (scan_directories (directory, new) != 0)
+    {
+      /* the directory was removed, the parent gets an event, too */
+      free (directory);
+      free_dir (new);
+      return;
+    }
+
+  /* the directory is empty now and has to vanish from the parent */
+  if (new->images.first == NULL && new->subdirs.first == NULL &&
+      old->parentdir != NULL)
+    {
+      free (directory);
+      free_dir (new);
+      update_dir (rootdir, old->parentdir, 0);
+      return;
+    }
+
+  set_stats_phase (PHASE_HTML);
+  if (full || memcmp (&new->config, &old->config, sizeof (config_t)) != 0)
+    update_html (new);
+  else
+    {
+      size_t i, count = 0;
+
+      for (subdir = new->subdirs.first; subdir != NULL; subdir = subdir->next)
+	count++;
+      added = malloc ((count + 1) * sizeof (dir_l *));
+      if (added == NULL)
+	yapa_oom ();
+      for (subdir = new->subdirs.first; subdir != NULL; subdir = subdir->next)
+	if (!has_subdir (old, subdir->name))
+	  added[nr_added++] = subdir;
+
+      update_directory (new);
+      for (i = 0; i < nr_added; i++)
+	update_html (added[i]);
+      free (added);
+    }
+
+  /* replace the old entry, running jobs may still use its config */
+  if (old->parentdir == NULL)
+    *rootdir = new;
+  else
+    list_replace (&old->parentdir->subdirs, old, new);
+  list_append (&obsolete_dirs, old);
+
+  free (directory);
+}
+
+static void
+collect_path (const char *key, void *value __attribute__((unused)),
+	      void *data)
+{
+  char ***ptr = data;
+  char *path = strdup (key);
+
+  if (path == NULL)
+    yapa_oom ();
+  *(*ptr)++ = path;
+}
+
+static void
+update_changed_dirs (const char *root_path, dir_l **rootdir)
+{
+  char **paths, **ptr;
+  size_t i, count = changed_dirs->count;
+
+  paths = malloc ((count + 1) * sizeof (char *));
+  if (paths == NULL)
+    yapa_oom ();
+  ptr = paths;
+  hash_foreach (changed_dirs, collect_path, &ptr);
+  hash_free (changed_dirs, NULL);
+  changed_dirs = hash_create (64);
+
+  for (i = 0; i < count; i++)
+    {
+      char *cp = paths[i];
+      dir_l *dir;
+
+      /* new or so far empty directories are not in the tree, the
+	 parent has to add them */
+      while ((dir = find_dir (*rootdir, root_path, paths[i])) == NULL &&
+	     (cp = strrchr (paths[i], '/')) != NULL &&
+	     strlen (paths[i]) > strlen (root_path))
+	*cp = '\0';
+
+      if (dir != NULL)
+	update_dir (rootdir, dir, 0);
+      free (paths[i]);
+    }
+  free (paths);
+}
+
+/* Watch the album and update it after changes. Returns only after
+   SIGINT or SIGTERM, or on errors.  */
+int
+watch_album (const char *root_path, dir_l **rootdir)
+{
+  struct sigaction sa;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = stop_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  changed_dirs = hash_create (64);
+  init_watches (root_path);
+  if (inotify_fd < 0)
+    {
+      fprintf (stderr, _("ERROR: Cannot initialize inotify: %m\n"));
+      return 1;
+    }
+
+  printf (_("Waiting for changes in %s\n"), root_path);
+
+  while (!stop_watching)
+    {
+      struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+      int timeout = -1;
+      int complete = 0;
+      int n;
+
+      /* wait until there were no new events for some time */
+      if (changed_dirs->count > 0 || events_lost)
+	timeout = WATCH_DEBOUNCE;
+
+      n = poll (&pfd, 1, timeout);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  fprintf (stderr, _("ERROR: Cannot wait for events: %m\n"));
+	  break;
+	}
+      if (n > 0)
+	{
+	  if (read_events () != 0)
+	    {
+	      fprintf (stderr, _("ERROR: Cannot read events: %m\n"));
+	      break;
+	    }
+	  continue;
+	}
+
+      if (events_lost)
+	{
+	  printf (_("Events were lost, reading the whole album again\n"));
+	  events_lost = 0;
+	  hash_free (changed_dirs, NULL);
+	  changed_dirs = hash_create (64);
+	  /* the watches of new directories are maybe missing */
+	  init_watches (root_path);
+	  if (inotify_fd < 0)
+	    {
+	      fprintf (stderr, _("ERROR: Cannot initialize inotify: %m\n"));
+	      break;
+	    }
+	  /* forget the directories, which don't exist anymore */
+	  load_scan_cache (root_path);
+	  update_dir (rootdir, *rootdir, 1);
+	  complete = 1;
+	}
+      else
+	update_changed_dirs (root_path, rootdir);
+
+      wait_for_jobs ();
+      unlock_directories ();
+      free_dirs (&obsolete_dirs);
+      save_scan_cache (complete);
+
+      printf (_("Waiting for changes in %s\n"), root_path);
+    }
+
+  if (inotify_fd >= 0)
+    close (inotify_fd);
+  inotify_fd = -1;
+  hash_free (changed_dirs, NULL);
+  changed_dirs = NULL;
+
+  return stop_watching ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <Imlib2.h>
+
+#include "main.h"
+
+/* Throughput of the resample implementations and of the scaling of
+   imlib2 in megapixels of the source image per second. Usage:
+   resample-bench [width height [runs]]  */
+
+int debug_flag = 0;
+
+void
+yapa_oom (void)
+{
+  fprintf (stderr, "Out of memory\n");
+  exit (1);
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *name, const char *impl, unsigned int width,
+	unsigned int height, unsigned int dst_width, unsigned int dst_height,
+	int runs, double secs)
+{
+  printf ("%-9s %-7s %ux%u -> %ux%u: %8.2f ms %8.1f MP/s\n", name, impl,
+	  width, height, dst_width, dst_height, secs * 1000.0 / runs,
+	  (double) width * height * runs / secs / 1e6);
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char *impls[] = { "scalar", "sse2", "avx2" };
+  static const unsigned int nail_sizes[] = { 640, 128 };
+  unsigned int width = 4000, height = 3000;
+  int runs = 5, filter, r;
+  size_t i, n, count;
+  uint32_t *src;
+
+  if (argc >= 3)
+    {
+      width = strtoul (argv[1], NULL, 10);
+      height = strtoul (argv[2], NULL, 10);
+    }
+  if (argc >= 4)
+    runs = atoi (argv[3]);
+  if (width == 0 || height == 0 || runs <= 0)
+    {
+      fprintf (stderr, "Usage: %s [width height [runs]]\n", argv[0]);
+      return 1;
+    }
+
+  count = (size_t) width * height;
+  src = malloc (count * sizeof (uint32_t));
+  if (src == NULL)
+    yapa_oom ();
+  srand (42);
+  for (i = 0; i < count; i++)
+    src[i] = ((uint32_t) rand () << 16) ^ (uint32_t) rand () ^ 0xff000000;
+
+  for (n = 0; n < sizeof (nail_sizes) / sizeof (nail_sizes[0]); n++)
+    {
+      unsigned int dst_width = nail_sizes[n];
+      unsigned int dst_height = (unsigned long long) height * dst_width / width;
+      Imlib_Image image;
+      double start;
+
+      if (dst_height == 0)
+	dst_height = 1;
+
+      for (filter = FILTER_LANCZOS3; filter <= FILTER_BOX; filter++)
+	for (i = 0; i < sizeof (impls) / sizeof (impls[0]); i++)
+	  {
+	    if (set_resample_impl (impls[i]) != 0)
+	      continue;
+
+	    start = now ();
+	    for (r = 0; r < runs; r++)
+	      free (resample_image (src, width, height, dst_width,
+				    dst_height, filter));
+	    report (resample_filter_name (filter), impls[i], width, height,
+		    dst_width, dst_height, runs, now () - start);
+	  }
+
+      /* imlib2 scaling with anti-aliasing as the nails were created
+	 before */
+      image = imlib_create_image_using_copied_data (width, height,
+						    (DATA32 *) src);
+      if (image == NULL)
+	{
+	  fprintf (stderr, "Cannot create imlib2 image\n");
+	  return 1;
+	}
+      imlib_context_set_image (image);
+      imlib_context_set_anti_alias (1);
+      start = now ();
+      for (r = 0; r < runs; r++)
+	{
+	  Imlib_Image scaled;
+
+	  imlib_context_set_image (image);
+	  scaled = imlib_create_cropped_scaled_image (0, 0, width, height,
+						      dst_width, dst_height);
+	  if (scaled == NULL)
+	    {
+	      fprintf (stderr, "imlib2 cannot scale the image\n");
+	      return 1;
+	    }
+	  imlib_context_set_image (scaled);
+	  imlib_free_image ();
+	}
+      report ("imlib2", "", width, height, dst_width, dst_height, runs,
+	      now () - start);
+      imlib_context_set_image (image);
+      imlib_free_image ();
+    }
+
+  free (src);
+  return 0;
+}
@@ -0,0 +1,130 @@
+/* Copyright (c) 2022 Thorsten Kukuk
+   Author: Thorsten Kukuk <kukuk@thkukuk.de>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 2 as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+
+/* Resample random images with the scalar reference and every SIMD
+   implementation the CPU supports, the results may only differ by
+   one per channel because of rounding.  */
+
+int debug_flag = 0;
+
+void
+yapa_oom (void)
+{
+  fprintf (stderr, "Out of memory\n");
+  exit (1);
+}
+
+static const struct {
+  unsigned int src_width, src_height, dst_width, dst_height;
+} sizes[] = {
+  { 640, 480, 160, 120 },    /* downscale by 4 */
+  { 1001, 667, 128, 85 },    /* odd sizes */
+  { 333, 777, 77, 179 },     /* portrait */
+  { 97, 61, 50, 31 },        /* small factor */
+  { 64, 48, 200, 150 },      /* upscale */
+  { 7, 5, 3, 2 },            /* less pixels than taps */
+  { 1, 1, 1, 1 },
+};
+#define NR_SIZES (sizeof (sizes) / sizeof (sizes[0]))
+
+static const char *simd_impls[] = { "sse2", "avx2" };
+#define NR_SIMD (sizeof (simd_impls) / sizeof (simd_impls[0]))
+
+static int
+max_diff (const uint32_t *a, const uint32_t *b, size_t count)
+{
+  int diff = 0;
+  size_t i;
+  int ch;
+
+  for (i = 0; i < count; i++)
+    for (ch = 0; ch < 32; ch += 8)
+      {
+	int d = (int)((a[i] >> ch) & 0xff) - (int)((b[i] >> ch) & 0xff);
+
+	if (d < 0)
+	  d = -d;
+	if (d > diff)
+	  diff = d;
+      }
+  return diff;
+}
+
+int
+main (void)
+{
+  int failed = 0, filter;
+  size_t s, i, j;
+
+  srand (42);
+
+  for (s = 0; s < NR_SIZES; s++)
+    {
+      size_t src_count = (size_t) sizes[s].src_width * sizes[s].src_height;
+      size_t dst_count = (size_t) sizes[s].dst_width * sizes[s].dst_height;
+      uint32_t *src = malloc (src_count * sizeof (uint32_t));
+
+      if (src == NULL)
+	yapa_oom ();
+      for (i = 0; i < src_count; i++)
+	src[i] = ((uint32_t) rand () << 16) ^ (uint32_t) rand ();
+
+      for (filter = FILTER_LANCZOS3; filter <= FILTER_BOX; filter++)
+	{
+	  uint32_t *ref;
+
+	  set_resample_impl ("scalar");
+	  ref = resample_image (src, sizes[s].src_width, sizes[s].src_height,
+				sizes[s].dst_width, sizes[s].dst_height,
+				filter);
+
+	  for (j = 0; j < NR_SIMD; j++)
+	    {
+	      uint32_t *dst;
+	      int diff;
+
+	      if (set_resample_impl (simd_impls[j]) != 0)
+		continue;
+
+	      dst = resample_image (src, sizes[s].src_width,
+				    sizes[s].src_height, sizes[s].dst_width,
+				    sizes[s].dst_height, filter);
+	      diff = max_diff (ref, dst, dst_count);
+	      printf ("%s %ux%u -> %ux%u %s: max. difference %d\n",
+		      resample_filter_name (filter),
+		      sizes[s].src_width, sizes[s].src_height,
+		      sizes[s].dst_width, sizes[s].dst_height,
+		      simd_impls[j], diff);
+	      if (diff > 1)
+		failed = 1;
+	      free (dst);
+	    }
+	  free (ref);
+	}
+      free (src);
+    }
+
+  return failed;
+}